@@ -0,0 +1,28 @@
+#pragma once
+// Histograms of the per-interval bandwidth.
+//
+// Summaries cannot be aggregated across nodes; histograms with the same
+// buckets everywhere can, so histogram_quantile() over a fleet shows the real
+// distribution of the sampled bandwidth. The buckets grow exponentially,
+// doubling from 1 MB/s to about 1 TB/s.
+
+#include <cstddef>
+
+#include <prometheus/histogram.h>
+
+// <count> boundaries start, start * factor, start * factor^2, ...
+prometheus::Histogram::BucketBoundaries exponentialBuckets(double start, double factor, size_t count)
+{
+  prometheus::Histogram::BucketBoundaries buckets;
+  double bound = start;
+  for (size_t i = 0; i < count; ++i, bound *= factor)
+    buckets.push_back(bound);
+  return buckets;
+}
+
+// Bytes per second: 1 MB/s .. 1 TB/s
+const prometheus::Histogram::BucketBoundaries &bandwidthBuckets()
+{
+  static const prometheus::Histogram::BucketBoundaries buckets = exponentialBuckets(1e6, 2.0, 21);
+  return buckets;
+}
@@ -5,6 +5,13 @@
 sudo apt update
 sudo apt install -y cmake libasan8 zlib1g-dev
 
+# zstd exposition encoding: ZSTD=1 ./build.sh (needs libzstd-dev)
+EXPORTER_ZSTD=""
+if [ "${ZSTD:-0}" = "1" ]; then
+  sudo apt install -y libzstd-dev
+  EXPORTER_ZSTD="-DPCM_EXPORTER_ZSTD -lzstd"
+fi
+
 # fetch third-party dependencies
 (
   # Install prometheus-cpp
@@ -15,7 +22,7 @@ sudo apt install -y cmake libasan8 zlib1g-dev
   mkdir -p prometheus-cpp/_build
   cd prometheus-cpp/_build
 
-  cmake .. -DBUILD_SHARED_LIBS=OFF -DENABLE_PUSH=OFF -DENABLE_COMPRESSION=OFF -DCMAKE_BUILD_TYPE=Release # run cmake
+  cmake .. -DBUILD_SHARED_LIBS=OFF -DENABLE_PUSH=OFF -DENABLE_COMPRESSION=ON -DCMAKE_BUILD_TYPE=Release # run cmake
   cmake --build . --parallel $(($(nproc)/2)) # build
   ctest -V # run tests
   cmake --install . # install the libraries and headers
@@ -38,7 +45,10 @@ wait
 
 mkdir -p ./bin
 
-g++ -fsanitize=address -g -o ./bin/pcm-pcie-exporter.out pcie-exporter.cpp \
+# embed the IIO event tables (opCode-*.txt) into the IIO exporter
+python3 gen-iio-event-tables.py iio-event-tables.h opCode-*.txt
+
+g++ -fsanitize=address -g -o ./bin/pcm-pcie-exporter.out pcie-exporter.cpp $EXPORTER_ZSTD \
   -I. \
   -I./pcm/src \
   -L./pcm/build/src \
@@ -46,14 +56,14 @@ g++ -fsanitize=address -g -o ./bin/pcm-pcie-exporter.out pcie-exporter.cpp \
   /usr/local/lib/libprometheus-cpp-pull.a \
   /usr/local/lib/libprometheus-cpp-core.a \
   -lz
-# g++ -fsanitize=address -g -o ./bin/pcm-iio-exporter.out iio-exporter.cpp \
+# g++ -fsanitize=address -g -o ./bin/pcm-iio-exporter.out iio-exporter.cpp $EXPORTER_ZSTD \
 #   -I. \
 #   -I./pcm/src \
 #   ./pcm/build/src/libpcm.a \
 #   /usr/local/lib/libprometheus-cpp-pull.a \
 #   /usr/local/lib/libprometheus-cpp-core.a \
 #   -lz
-g++ -fsanitize=address -g -o ./bin/pcm-memory-exporter.out pcm-memory-exporter.cpp \
+g++ -fsanitize=address -g -o ./bin/pcm-memory-exporter.out pcm-memory-exporter.cpp $EXPORTER_ZSTD \
   -I. \
   -I./pcm/src \
   ./pcm/build/src/libpcm.a \
@@ -0,0 +1,42 @@
+#pragma once
+// Monotonic _bytes_total counters next to the bandwidth gauges.
+//
+// The gauges hold the rate of the last sampling window only, which a scrape
+// every 15 s sees a fraction of. An IntegratedCounter adds the sampled rate
+// over the whole time since the previous sample, so gaps between windows
+// (longer periods, multiplexed IIO events) are filled with the estimate and
+// rate() over any range approximates the true average. Counters start at zero
+// on every exporter start, which Prometheus handles as a counter reset.
+
+#include <chrono>
+
+#include <prometheus/counter.h>
+
+class IntegratedCounter
+{
+public:
+  typedef std::chrono::steady_clock clock;
+
+  explicit IntegratedCounter(prometheus::Counter &c) : counter(&c) {}
+
+  /*
+   * Adds <rate> (per second) over the time since the previous sample, taken at
+   * <time>. The first sample covers its own <window> seconds. A sample that is
+   * not newer than the previous one is ignored.
+   */
+  void update(double rate, double window, clock::time_point time)
+  {
+    if (started && time <= last)
+      return;
+    const double seconds = started ? std::chrono::duration<double>(time - last).count() : window;
+    if (rate > 0.0 && seconds > 0.0)
+      counter->Increment(rate * seconds);
+    last = time;
+    started = true;
+  }
+
+private:
+  prometheus::Counter *counter;
+  clock::time_point last;
+  bool started = false;
+};
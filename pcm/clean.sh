@@ -3,4 +3,5 @@
 rm -rf prometheus-cpp
 rm -rf pcm
 rm -rf *.out
+rm -f iio-event-tables.h
 rm -rf ./bin/*.out
@@ -0,0 +1,103 @@
+#pragma once
+// Wrap-safe accumulation of uncore counter deltas.
+//
+// Uncore PMON counters are narrower than 64 bits and PCM hands out their raw
+// values, so a plain after - before is wrong once a counter wraps and garbage
+// when it was reprogrammed (zeroed) between the two reads. CounterAccumulator
+// keeps the exact 64-bit total of the events and the time measured over, and
+// the events of the last measurement; rates are derived from them where they
+// are exported.
+
+#include <cstdint>
+
+enum class UncorePmu
+{
+  iio, // IIO stacks (pcm-iio)
+  imc  // memory controller channels
+};
+
+// Width of the general purpose counters of <pmu> in bits on the platforms that
+// have it (Skylake-SP and later for IIO). The width of the CBo/CHA counters
+// differs between platforms and comes with the pcm-pcie event tables.
+constexpr uint32_t uncoreCounterWidth(UncorePmu pmu)
+{
+  switch (pmu)
+  {
+  case UncorePmu::iio:
+  case UncorePmu::imc:
+    return 48;
+  }
+  return 64;
+}
+
+constexpr uint64_t counterMask(uint32_t width)
+{
+  return width >= 64 ? ~0ULL : (1ULL << width) - 1;
+}
+
+/*
+ * Events between two raw reads of a <width> bit counter. A wrap is assumed when
+ * after < before. A difference of more than half the range cannot be a wrap
+ * within a sampling interval (2^43 events of a 44 bit counter take more than
+ * half an hour even at 4 GHz), so the counter was reset in between and counted
+ * <after> events since.
+ */
+constexpr uint64_t counterDelta(uint64_t before, uint64_t after, uint32_t width)
+{
+  return ((after - before) & counterMask(width)) > (counterMask(width) >> 1)
+             ? (after & counterMask(width))
+             : ((after - before) & counterMask(width));
+}
+
+class CounterAccumulator
+{
+  uint32_t width;
+  uint64_t events = 0;  // measured events since start
+  double seconds = 0.0; // measured time since start
+  uint64_t lastEvents = 0;
+  double lastSeconds = 0.0;
+
+public:
+  explicit CounterAccumulator(uint32_t width_bits = 48) : width(width_bits) {}
+
+  // Adds the events between two raw reads taken <elapsed> seconds apart.
+  uint64_t add(uint64_t before, uint64_t after, double elapsed)
+  {
+    const uint64_t delta = counterDelta(before, after, width);
+    events += delta;
+    seconds += elapsed;
+    lastEvents = delta;
+    lastSeconds = elapsed;
+    return delta;
+  }
+
+  double measured() const { return seconds; }
+
+  // Events since start, scaled by multiplier / divider.
+  double total(uint64_t multiplier = 1, uint64_t divider = 1) const
+  {
+    if (divider == 0)
+      return 0.0;
+    return (double)(events * multiplier) / (double)divider;
+  }
+
+  // Events of the last measurement, scaled by multiplier / divider.
+  double last(uint64_t multiplier = 1, uint64_t divider = 1) const
+  {
+    if (divider == 0)
+      return 0.0;
+    return (double)(lastEvents * multiplier) / (double)divider;
+  }
+
+  // Events per second over the last measurement, scaled by multiplier / divider.
+  double rate(uint64_t multiplier = 1, uint64_t divider = 1) const
+  {
+    if (lastSeconds <= 0.0)
+      return 0.0;
+    return last(multiplier, divider) / lastSeconds;
+  }
+};
+
+static_assert(counterDelta(10, 20, 48) == 10, "counterDelta");
+static_assert(counterDelta(0xFFFFFFFFFFF0ULL, 0x10, 48) == 0x20, "counterDelta wrap");
+static_assert(counterDelta(0x800000000000ULL, 0x5, 48) == 0x5, "counterDelta reset");
@@ -0,0 +1,201 @@
+#pragma once
+// CPU placement of exporter threads.
+//
+// HPC jobs own the isolated cores, so every exporter thread (main loop,
+// sampler, prometheus-cpp/civetweb HTTP workers) is confined to a housekeeping
+// cpuset. The affinity is applied to the whole process before the HTTP server
+// is started, so threads created later inherit it.
+
+#include <sched.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "utils.h"
+
+bool housekeepingEnabled = false;
+cpu_set_t housekeepingCpus;
+std::string housekeepingCpuList;
+int snapshotFifoPriority = 0; // 0 => keep the default scheduling class
+
+// Parses a kernel style cpu list ("0-3,8,10-11") into a cpu set.
+bool parseCpuList(const std::string &list, cpu_set_t &set)
+{
+  CPU_ZERO(&set);
+  size_t pos = 0;
+  bool any = false;
+  while (pos < list.size())
+  {
+    size_t next = list.find(',', pos);
+    if (next == std::string::npos)
+      next = list.size();
+    const std::string item = list.substr(pos, next - pos);
+    pos = next + 1;
+    if (item.empty() || item == "\n")
+      continue;
+
+    char *end = nullptr;
+    const long first = strtol(item.c_str(), &end, 10);
+    long last = first;
+    if (*end == '-')
+      last = strtol(end + 1, &end, 10);
+    if ((*end != '\0' && *end != '\n') || first < 0 || last < first || last >= CPU_SETSIZE)
+      return false;
+    for (long cpu = first; cpu <= last; ++cpu)
+      CPU_SET(cpu, &set);
+    any = true;
+  }
+  return any;
+}
+
+bool readSysfsCpuList(const char *path, cpu_set_t &set)
+{
+  std::ifstream in(path);
+  std::string list;
+  if (!in.is_open() || !std::getline(in, list))
+  {
+    CPU_ZERO(&set);
+    return false;
+  }
+  return parseCpuList(list, set);
+}
+
+// "auto" housekeeping set: online CPUs minus isolcpus= and nohz_full= ones.
+bool getAutoHousekeepingCpus(cpu_set_t &set)
+{
+  cpu_set_t isolated, nohz;
+  if (!readSysfsCpuList("/sys/devices/system/cpu/online", set))
+    return false;
+  readSysfsCpuList("/sys/devices/system/cpu/isolated", isolated);
+  readSysfsCpuList("/sys/devices/system/cpu/nohz_full", nohz);
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+  {
+    if (CPU_ISSET(cpu, &isolated) || CPU_ISSET(cpu, &nohz))
+      CPU_CLR(cpu, &set);
+  }
+  return CPU_COUNT(&set) > 0;
+}
+
+bool parseAffinityArg(const char *arg)
+{
+  std::string arg_value;
+  if (pcm::extract_argument_value(arg, {"-housekeeping-cpus", "/housekeeping-cpus"}, arg_value))
+  {
+    const bool ok = (arg_value == "auto") ? getAutoHousekeepingCpus(housekeepingCpus)
+                                          : parseCpuList(arg_value, housekeepingCpus);
+    if (!ok)
+    {
+      std::cerr << "Invalid housekeeping cpu list: " << arg_value << "\n";
+      exit(EXIT_FAILURE);
+    }
+    housekeepingEnabled = true;
+    housekeepingCpuList = arg_value;
+    return true;
+  }
+  if (pcm::check_argument_equals(arg, {"-snapshot-fifo", "/snapshot-fifo"}))
+  {
+    snapshotFifoPriority = 1;
+    return true;
+  }
+  if (pcm::extract_argument_value(arg, {"-snapshot-fifo", "/snapshot-fifo"}, arg_value))
+  {
+    snapshotFifoPriority = atoi(arg_value.c_str());
+    if (snapshotFifoPriority < sched_get_priority_min(SCHED_FIFO) || snapshotFifoPriority > sched_get_priority_max(SCHED_FIFO))
+    {
+      std::cerr << "Invalid SCHED_FIFO priority: " << arg_value << "\n";
+      exit(EXIT_FAILURE);
+    }
+    return true;
+  }
+  return false;
+}
+
+void print_affinity_options_help()
+{
+  std::cout << "  -housekeeping-cpus=<list|auto>     => run all exporter threads (sampler, HTTP workers) on <list>, e.g. 0-1,64-65.\n"
+            << "                                        'auto' uses online CPUs that are not in isolcpus=/nohz_full=\n";
+  std::cout << "  -snapshot-fifo[=prio]              => raise the sampler to SCHED_FIFO (default priority 1) while counters are read\n";
+}
+
+// Applies the housekeeping cpuset to every thread that already exists.
+// Threads created afterwards inherit the mask of their creator.
+bool applyHousekeepingAffinity()
+{
+  if (!housekeepingEnabled)
+    return true;
+
+  bool ok = true;
+  DIR *dir = opendir("/proc/self/task");
+  if (dir)
+  {
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+      if (entry->d_name[0] == '.')
+        continue;
+      const pid_t tid = (pid_t)atoi(entry->d_name);
+      if (sched_setaffinity(tid, sizeof(cpu_set_t), &housekeepingCpus) != 0)
+      {
+        std::cerr << "Failed to set affinity of thread " << tid << ": " << strerror(errno) << "\n";
+        ok = false;
+      }
+    }
+    closedir(dir);
+  }
+  else if (sched_setaffinity(0, sizeof(cpu_set_t), &housekeepingCpus) != 0)
+  {
+    std::cerr << "Failed to set affinity: " << strerror(errno) << "\n";
+    ok = false;
+  }
+
+  if (ok)
+    std::cout << "[INFO] Exporter threads are confined to housekeeping CPUs " << housekeepingCpuList << std::endl;
+  return ok;
+}
+
+/*
+ * Raises the calling thread to SCHED_FIFO for the lifetime of the object, so
+ * that the before/after counter snapshots are not delayed by a preemption.
+ * The thread is returned to SCHED_OTHER before it goes to sleep.
+ */
+class SnapshotPriorityGuard
+{
+  bool raised = false;
+
+  SnapshotPriorityGuard(const SnapshotPriorityGuard &) = delete;
+  SnapshotPriorityGuard &operator=(const SnapshotPriorityGuard &) = delete;
+
+public:
+  SnapshotPriorityGuard()
+  {
+    if (snapshotFifoPriority <= 0)
+      return;
+    struct sched_param param;
+    param.sched_priority = snapshotFifoPriority;
+    raised = (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0);
+    if (!raised)
+    {
+      static bool warned = false;
+      if (!warned)
+      {
+        std::cerr << "WARNING: cannot switch the sampler to SCHED_FIFO, snapshots run with the default scheduling class\n";
+        warned = true;
+      }
+    }
+  }
+  ~SnapshotPriorityGuard()
+  {
+    if (!raised)
+      return;
+    struct sched_param param;
+    param.sched_priority = 0;
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+  }
+};
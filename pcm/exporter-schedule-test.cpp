@@ -0,0 +1,68 @@
+// Tests of the multi-rate sampling schedule.
+//
+//   make test-schedule
+#include <chrono>
+#include <iostream>
+#include "exporter-schedule.h"
+
+int failures = 0;
+int checks = 0;
+
+#define CHECK(condition)                                                         \
+  do                                                                             \
+  {                                                                              \
+    ++checks;                                                                    \
+    if (!(condition))                                                            \
+    {                                                                            \
+      ++failures;                                                                \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": failed: " #condition "\n"; \
+    }                                                                            \
+  } while (0)
+
+typedef MultiRateSchedule::clock schedule_clock;
+
+void testBackToBack()
+{
+  // A pass that takes the whole period: the next one is due when it ends
+  MultiRateSchedule schedule;
+  const size_t idx = schedule.add("iio", 1.0);
+  const schedule_clock::time_point start = schedule.entry(idx).next_due;
+  for (int pass = 1; pass <= 5; ++pass)
+  {
+    const schedule_clock::time_point end = start + std::chrono::milliseconds(1000 * pass + 2);
+    schedule.completed(idx, end);
+    CHECK(schedule.entry(idx).next_due == start + std::chrono::seconds(pass));
+    CHECK(schedule.entry(idx).next_due <= end);
+  }
+}
+
+void testEarly()
+{
+  // A pass shorter than the period: the next one waits for the rest of it
+  MultiRateSchedule schedule;
+  const size_t idx = schedule.add("memory", 2.0);
+  const schedule_clock::time_point start = schedule.entry(idx).next_due;
+  schedule.completed(idx, start + std::chrono::milliseconds(300));
+  CHECK(schedule.entry(idx).next_due == start + std::chrono::seconds(2));
+}
+
+void testMissed()
+{
+  // Whole missed periods are skipped, keeping the phase
+  MultiRateSchedule schedule;
+  const size_t idx = schedule.add("pcie", 1.0);
+  const schedule_clock::time_point start = schedule.entry(idx).next_due;
+  schedule.completed(idx, start + std::chrono::milliseconds(3500));
+  CHECK(schedule.entry(idx).next_due == start + std::chrono::seconds(3));
+  schedule.completed(idx, start + std::chrono::milliseconds(3600));
+  CHECK(schedule.entry(idx).next_due == start + std::chrono::seconds(4));
+}
+
+int main()
+{
+  testBackToBack();
+  testEarly();
+  testMissed();
+  std::cout << checks << " checks, " << failures << " failed\n";
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+#pragma once
+// Multi-rate sampling schedule.
+//
+// Every entry (an event group of a collector, or the collector itself) has its
+// own period. A sampling cycle only runs the entries that are due, so rarely
+// needed events do not take counter time away from the frequently sampled ones.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+class MultiRateSchedule
+{
+public:
+  typedef std::chrono::steady_clock clock;
+
+  struct Entry
+  {
+    std::string name;
+    double period; // in seconds
+    clock::time_point next_due;
+  };
+
+  size_t add(const std::string &name, double period)
+  {
+    entries.push_back(Entry{name, period, clock::now()});
+    return entries.size() - 1;
+  }
+
+  const Entry &entry(size_t idx) const { return entries[idx]; }
+  size_t size() const { return entries.size(); }
+
+  // Returns the entries that are due. If none is, sleeps until the earliest one.
+  std::vector<size_t> waitForDue()
+  {
+    std::vector<size_t> due;
+    if (entries.empty())
+      return due;
+
+    auto now = clock::now();
+    auto earliest = entries.front().next_due;
+    for (const auto &e : entries)
+      earliest = (std::min)(earliest, e.next_due);
+    if (earliest > now)
+    {
+      std::this_thread::sleep_until(earliest);
+      now = clock::now();
+    }
+
+    for (size_t idx = 0; idx < entries.size(); ++idx)
+    {
+      if (entries[idx].next_due <= now)
+        due.push_back(idx);
+    }
+    return due;
+  }
+
+  /*
+   * Schedules the next run of an entry, one period after the previous one, so
+   * a pass that takes the whole period is followed by the next one without a
+   * gap. Whole periods that were missed are skipped, not replayed.
+   */
+  void completed(size_t idx, clock::time_point now = clock::now())
+  {
+    auto &e = entries[idx];
+    const auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(e.period));
+    e.next_due += period;
+    if (period > clock::duration::zero() && now - e.next_due >= period)
+      e.next_due += ((now - e.next_due) / period) * period;
+  }
+
+private:
+  std::vector<Entry> entries;
+};
+
+// Parses "<name>:<seconds>" as given to -period=.
+bool parsePeriodSpec(const std::string &spec, std::string &name, double &period)
+{
+  const size_t colon = spec.rfind(':');
+  if (colon == std::string::npos || colon == 0)
+    return false;
+  name = spec.substr(0, colon);
+  char *end = nullptr;
+  period = strtod(spec.c_str() + colon + 1, &end);
+  return end && *end == '\0' && period > 0.0;
+}
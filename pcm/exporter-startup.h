@@ -0,0 +1,60 @@
+#pragma once
+// Timing of the exporter startup phases (PCM init, programming, PCI discovery,
+// event file parsing, ...), printed at startup and exported as
+// exporter_startup_phase_seconds{phase}.
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <prometheus/gauge.h>
+#include <prometheus/registry.h>
+
+class StartupTimer
+{
+public:
+  typedef std::chrono::steady_clock clock;
+
+  StartupTimer() : last(clock::now()) {}
+
+  // Ends the current phase: the time since the previous mark is recorded as <phase>.
+  void mark(const std::string &phase)
+  {
+    const auto now = clock::now();
+    phases.push_back(std::make_pair(phase, std::chrono::duration<double>(now - last).count()));
+    last = now;
+  }
+
+  const std::vector<std::pair<std::string, double>> &getPhases() const { return phases; }
+
+  double total() const
+  {
+    double sum = 0.0;
+    for (const auto &phase : phases)
+      sum += phase.second;
+    return sum;
+  }
+
+  void print(std::ostream &out) const
+  {
+    for (const auto &phase : phases)
+      out << "[INFO] Startup phase " << phase.first << ": " << phase.second * 1000.0 << " ms\n";
+    out << "[INFO] Startup total: " << total() * 1000.0 << " ms" << std::endl;
+  }
+
+  void publish(prometheus::Registry &registry) const
+  {
+    auto &family = prometheus::BuildGauge()
+                       .Name("exporter_startup_phase_seconds")
+                       .Help("Duration of the exporter startup phases in seconds")
+                       .Register(registry);
+    for (const auto &phase : phases)
+      family.Add({{"phase", phase.first}}).Set(phase.second);
+  }
+
+private:
+  clock::time_point last;
+  std::vector<std::pair<std::string, double>> phases;
+};
@@ -0,0 +1,182 @@
+#pragma once
+// Scrape-time filtering of the pre-rendered exposition.
+//
+// /metrics?collect[]=<collector>&level=<level> serves a subset of the cycle:
+//
+//   collect[]  a collector (the family name without "pcm_" up to the first '_':
+//              iio, pcie, memory, exporter) or a full family name; repeatable
+//   level      system (or node), socket, stack, channel or part; repeatable or
+//              comma-separated, the same names as -levels of the IIO exporter
+//
+// A series' level comes from its "level" label if it has one, otherwise from
+// the most specific of its part (part="Total" is a stack series), channel,
+// stack and socket labels; a series without them is a system series. Families
+// that lose all their series are dropped. Without parameters the full
+// exposition is served.
+
+#include <cctype>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <prometheus/client_metric.h>
+
+// Collector of a metric family: pcm_iio_window -> iio, pcie_bandwidth -> pcie.
+std::string exportCollector(const std::string &family)
+{
+  const std::string name = family.compare(0, 4, "pcm_") == 0 ? family.substr(4) : family;
+  return name.substr(0, name.find('_'));
+}
+
+// Aggregation levels, from the coarsest.
+const char *exportLevelNames[] = {"system", "socket", "stack", "channel", "part"};
+
+// The level named <name>, with node as an alias of system; empty for an unknown name.
+std::string canonicalExportLevel(const std::string &name)
+{
+  const std::string level = name == "node" ? "system" : name;
+  for (const char *known : exportLevelNames)
+  {
+    if (level == known)
+      return level;
+  }
+  return std::string();
+}
+
+// Aggregation level of a series, see the header comment.
+std::string exportLevel(const prometheus::ClientMetric &metric)
+{
+  std::string level = "system";
+  int rank = 0;
+  for (const auto &label : metric.label)
+  {
+    if (label.name == "level")
+      return label.value;
+    int r = 0;
+    std::string l;
+    if (label.name == "socket")
+      r = 1, l = "socket";
+    else if (label.name == "stack")
+      r = 2, l = "stack";
+    else if (label.name == "channel")
+      r = 2, l = "channel";
+    else if (label.name == "part")
+      r = 3, l = label.value == "Total" ? "stack" : "part";
+    if (r > rank)
+    {
+      rank = r;
+      level = l;
+    }
+  }
+  return level;
+}
+
+class ExpositionFilter
+{
+public:
+  std::set<std::string> collectors;
+  std::set<std::string> levels;
+
+  bool empty() const { return collectors.empty() && levels.empty(); }
+
+  /*
+   * Parses the query string (after '?'). Returns false with <error> set for an
+   * unknown level; other parameters are ignored.
+   */
+  bool parse(const std::string &query, std::string &error)
+  {
+    std::istringstream parameters(query);
+    std::string parameter;
+    while (std::getline(parameters, parameter, '&'))
+    {
+      const size_t equals = parameter.find('=');
+      if (equals == std::string::npos)
+        continue;
+      const std::string name = decode(parameter.substr(0, equals));
+      std::istringstream values(decode(parameter.substr(equals + 1)));
+      std::string value;
+      while (std::getline(values, value, ','))
+      {
+        if (value.empty())
+          continue;
+        if (name == "collect[]" || name == "collect")
+          collectors.insert(value);
+        else if (name == "level" || name == "level[]")
+        {
+          const std::string level = canonicalExportLevel(value);
+          if (level.empty())
+          {
+            error = "unknown level " + value + " (system or node, socket, stack, channel or part)";
+            return false;
+          }
+          levels.insert(level);
+        }
+      }
+    }
+    return true;
+  }
+
+  // Normalized form, equal for equal filters.
+  std::string key() const
+  {
+    std::string k;
+    for (const auto &c : collectors)
+      k += "c=" + c + "&";
+    for (const auto &l : levels)
+      k += "l=" + l + "&";
+    return k;
+  }
+
+  bool selects(const prometheus::MetricFamily &family) const
+  {
+    return collectors.empty() || collectors.count(family.name) || collectors.count(exportCollector(family.name));
+  }
+
+  std::vector<prometheus::MetricFamily> apply(const std::vector<prometheus::MetricFamily> &families) const
+  {
+    std::vector<prometheus::MetricFamily> result;
+    for (const auto &family : families)
+    {
+      if (!selects(family))
+        continue;
+      if (levels.empty())
+      {
+        result.push_back(family);
+        continue;
+      }
+      prometheus::MetricFamily selected;
+      selected.name = family.name;
+      selected.help = family.help;
+      selected.type = family.type;
+      for (const auto &metric : family.metric)
+      {
+        if (levels.count(exportLevel(metric)))
+          selected.metric.push_back(metric);
+      }
+      if (!selected.metric.empty())
+        result.push_back(std::move(selected));
+    }
+    return result;
+  }
+
+private:
+  // Percent-decoding of a query component, '+' is a space.
+  static std::string decode(const std::string &value)
+  {
+    std::string out;
+    for (size_t i = 0; i < value.size(); ++i)
+    {
+      if (value[i] == '+')
+        out += ' ';
+      else if (value[i] == '%' && i + 2 < value.size() && isxdigit((unsigned char)value[i + 1]) && isxdigit((unsigned char)value[i + 2]))
+      {
+        out += (char)std::stoi(value.substr(i + 1, 2), nullptr, 16);
+        i += 2;
+      }
+      else
+        out += value[i];
+    }
+    return out;
+  }
+};
@@ -0,0 +1,425 @@
+#pragma once
+// Exposition formats of the pre-rendered endpoint.
+//
+// prometheus-cpp only writes the 0.0.4 text format, which the exporters serve
+// without timestamps. The pre-rendered endpoint serializes the collected
+// families itself: the 0.0.4 text format, and the OpenMetrics 1.0.0 text
+// format and the delimited io.prometheus.client protobuf format with every
+// sample's timestamp_ms, the end of the window it was measured in. The format
+// is picked from the request's Accept header.
+
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <prometheus/client_metric.h>
+
+enum class ExpositionFormat
+{
+  text,        // text/plain; version=0.0.4
+  openMetrics, // application/openmetrics-text; version=1.0.0
+  protobuf     // application/vnd.google.protobuf; proto=io.prometheus.client.MetricFamily; encoding=delimited
+};
+
+// Wall clock time in ms of <time>, a steady_clock time point of the sampler.
+int64_t sampleTimestampMs(std::chrono::steady_clock::time_point time)
+{
+  const auto wall = std::chrono::system_clock::now() - std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::steady_clock::now() - time);
+  return std::chrono::duration_cast<std::chrono::milliseconds>(wall.time_since_epoch()).count();
+}
+
+const char *expositionContentType(ExpositionFormat format)
+{
+  switch (format)
+  {
+  case ExpositionFormat::openMetrics:
+    return "application/openmetrics-text; version=1.0.0; charset=utf-8";
+  case ExpositionFormat::protobuf:
+    return "application/vnd.google.protobuf; proto=io.prometheus.client.MetricFamily; encoding=delimited";
+  case ExpositionFormat::text:
+    break;
+  }
+  return "text/plain; version=0.0.4; charset=utf-8";
+}
+
+/*
+ * The format with the highest q value in the Accept header in <head> (request
+ * line and headers); the first one listed wins a tie. Without a supported media
+ * range, or without the header, it is the 0.0.4 text format.
+ */
+ExpositionFormat negotiateExpositionFormat(const std::string &head)
+{
+  std::string lower(head);
+  for (auto &c : lower)
+    c = (char)std::tolower((unsigned char)c);
+  const std::string name = "\r\naccept:";
+  const size_t start = lower.find(name);
+  if (start == std::string::npos)
+    return ExpositionFormat::text;
+  const size_t end = lower.find("\r\n", start + name.size());
+  std::istringstream ranges(lower.substr(start + name.size(), end == std::string::npos ? std::string::npos : end - start - name.size()));
+
+  ExpositionFormat best = ExpositionFormat::text;
+  double best_q = 0.0;
+  std::string range;
+  while (std::getline(ranges, range, ','))
+  {
+    std::string compact;
+    for (const char c : range)
+    {
+      if (c != ' ' && c != '\t')
+        compact += c;
+    }
+    const std::string type = compact.substr(0, compact.find(';'));
+    const size_t q_pos = compact.find(";q=");
+    const double q = q_pos == std::string::npos ? 1.0 : atof(compact.c_str() + q_pos + 3);
+
+    ExpositionFormat format;
+    if (type == "application/vnd.google.protobuf")
+    {
+      if (compact.find(";proto=io.prometheus.client.metricfamily") == std::string::npos ||
+          compact.find(";encoding=delimited") == std::string::npos)
+        continue;
+      format = ExpositionFormat::protobuf;
+    }
+    else if (type == "application/openmetrics-text")
+    {
+      const size_t version = compact.find(";version=");
+      if (version != std::string::npos && compact.compare(version + 9, 5, "1.0.0") != 0 && compact.compare(version + 9, 5, "0.0.1") != 0)
+        continue;
+      format = ExpositionFormat::openMetrics;
+    }
+    else if (type == "text/plain" || type == "text/*" || type == "*/*")
+      format = ExpositionFormat::text;
+    else
+      continue;
+    if (q > best_q)
+    {
+      best = format;
+      best_q = q;
+    }
+  }
+  return best;
+}
+
+namespace openmetrics
+{
+  void writeNumber(std::ostream &out, double value)
+  {
+    if (std::isnan(value))
+      out << "NaN";
+    else if (std::isinf(value))
+      out << (value > 0 ? "+Inf" : "-Inf");
+    else
+    {
+      // Shortest of %.15g and %.17g that reads back as <value>.
+      char buffer[32];
+      snprintf(buffer, sizeof(buffer), "%.15g", value);
+      if (strtod(buffer, nullptr) != value)
+        snprintf(buffer, sizeof(buffer), "%.17g", value);
+      out << buffer;
+    }
+  }
+
+  // Label values escape quotes in both formats, HELP text only in OpenMetrics.
+  void writeEscaped(std::ostream &out, const std::string &value, bool quotes = true)
+  {
+    for (const char c : value)
+    {
+      if (c == '\\')
+        out << "\\\\";
+      else if (c == '"' && quotes)
+        out << "\\\"";
+      else if (c == '\n')
+        out << "\\n";
+      else
+        out << c;
+    }
+  }
+
+  // name{labels,extra="value"} value [timestamp]
+  void writeSample(std::ostream &out, const std::string &name, const prometheus::ClientMetric &metric, double value, bool timestamp,
+                   const char *extra_name = nullptr, const std::string &extra_value = std::string())
+  {
+    out << name;
+    if (!metric.label.empty() || extra_name)
+    {
+      const char *separator = "{";
+      for (const auto &label : metric.label)
+      {
+        out << separator << label.name << "=\"";
+        writeEscaped(out, label.value);
+        out << '"';
+        separator = ",";
+      }
+      if (extra_name)
+      {
+        out << separator << extra_name << "=\"";
+        writeEscaped(out, extra_value);
+        out << '"';
+      }
+      out << '}';
+    }
+    out << ' ';
+    writeNumber(out, value);
+    if (timestamp && metric.timestamp_ms != 0)
+    {
+      char buffer[32];
+      snprintf(buffer, sizeof(buffer), " %lld.%03lld", (long long)(metric.timestamp_ms / 1000), (long long)(metric.timestamp_ms % 1000));
+      out << buffer;
+    }
+    out << '\n';
+  }
+
+  std::string formatBound(double value)
+  {
+    std::ostringstream out;
+    writeNumber(out, value);
+    return out.str();
+  }
+}
+
+/*
+ * Text exposition: OpenMetrics 1.0.0 (with timestamps, terminated by # EOF) or,
+ * without <openMetrics>, the 0.0.4 format without timestamps.
+ */
+std::string serializeText(const std::vector<prometheus::MetricFamily> &families, bool openMetrics)
+{
+  using namespace openmetrics;
+  std::ostringstream out;
+  for (const auto &family : families)
+  {
+    // OpenMetrics counter families are named without _total, their samples with it.
+    std::string name = family.name;
+    std::string counter = family.name;
+    const char *type = openMetrics ? "unknown" : "untyped";
+    switch (family.type)
+    {
+    case prometheus::MetricType::Counter:
+      type = "counter";
+      if (openMetrics && name.size() > 6 && name.compare(name.size() - 6, 6, "_total") == 0)
+        name.resize(name.size() - 6);
+      if (openMetrics)
+        counter = name + "_total";
+      break;
+    case prometheus::MetricType::Gauge:
+      type = "gauge";
+      break;
+    case prometheus::MetricType::Summary:
+      type = "summary";
+      break;
+    case prometheus::MetricType::Histogram:
+      type = "histogram";
+      break;
+    default:
+      break;
+    }
+    if (!family.help.empty())
+    {
+      out << "# HELP " << name << ' ';
+      writeEscaped(out, family.help, openMetrics);
+      out << '\n';
+    }
+    out << "# TYPE " << name << ' ' << type << '\n';
+    for (const auto &metric : family.metric)
+    {
+      switch (family.type)
+      {
+      case prometheus::MetricType::Counter:
+        writeSample(out, counter, metric, metric.counter.value, openMetrics);
+        break;
+      case prometheus::MetricType::Gauge:
+        writeSample(out, name, metric, metric.gauge.value, openMetrics);
+        break;
+      case prometheus::MetricType::Summary:
+        for (const auto &q : metric.summary.quantile)
+          writeSample(out, name, metric, q.value, openMetrics, "quantile", formatBound(q.quantile));
+        writeSample(out, name + "_sum", metric, metric.summary.sample_sum, openMetrics);
+        writeSample(out, name + "_count", metric, (double)metric.summary.sample_count, openMetrics);
+        break;
+      case prometheus::MetricType::Histogram:
+      {
+        bool inf = false;
+        for (const auto &b : metric.histogram.bucket)
+        {
+          writeSample(out, name + "_bucket", metric, (double)b.cumulative_count, openMetrics, "le", formatBound(b.upper_bound));
+          inf = inf || std::isinf(b.upper_bound);
+        }
+        if (!inf)
+          writeSample(out, name + "_bucket", metric, (double)metric.histogram.sample_count, openMetrics, "le", "+Inf");
+        writeSample(out, name + "_sum", metric, metric.histogram.sample_sum, openMetrics);
+        writeSample(out, name + "_count", metric, (double)metric.histogram.sample_count, openMetrics);
+        break;
+      }
+      default:
+        writeSample(out, name, metric, metric.untyped.value, openMetrics);
+        break;
+      }
+    }
+  }
+  if (openMetrics)
+    out << "# EOF\n";
+  return out.str();
+}
+
+namespace protobuf
+{
+  // Wire types of the io.prometheus.client messages.
+  enum WireType
+  {
+    varint = 0,
+    fixed64 = 1,
+    lengthDelimited = 2
+  };
+
+  void writeVarint(std::string &out, uint64_t value)
+  {
+    while (value >= 0x80)
+    {
+      out += (char)((value & 0x7F) | 0x80);
+      value >>= 7;
+    }
+    out += (char)value;
+  }
+
+  void writeTag(std::string &out, uint32_t field, WireType type)
+  {
+    writeVarint(out, ((uint64_t)field << 3) | type);
+  }
+
+  void writeVarintField(std::string &out, uint32_t field, uint64_t value)
+  {
+    writeTag(out, field, varint);
+    writeVarint(out, value);
+  }
+
+  void writeDouble(std::string &out, uint32_t field, double value)
+  {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    writeTag(out, field, fixed64);
+    for (int i = 0; i < 8; ++i)
+      out += (char)(bits >> (8 * i));
+  }
+
+  void writeBytes(std::string &out, uint32_t field, const std::string &value)
+  {
+    writeTag(out, field, lengthDelimited);
+    writeVarint(out, value.size());
+    out += value;
+  }
+
+  // Metric message (metrics.proto) of <metric> in a family of <type>.
+  std::string encodeMetric(const prometheus::ClientMetric &metric, prometheus::MetricType type)
+  {
+    std::string out, value;
+    for (const auto &label : metric.label)
+    {
+      std::string pair;
+      writeBytes(pair, 1, label.name);
+      writeBytes(pair, 2, label.value);
+      writeBytes(out, 1, pair);
+    }
+    switch (type)
+    {
+    case prometheus::MetricType::Gauge:
+      writeDouble(value, 1, metric.gauge.value);
+      writeBytes(out, 2, value);
+      break;
+    case prometheus::MetricType::Counter:
+      writeDouble(value, 1, metric.counter.value);
+      writeBytes(out, 3, value);
+      break;
+    case prometheus::MetricType::Summary:
+      writeVarintField(value, 1, metric.summary.sample_count);
+      writeDouble(value, 2, metric.summary.sample_sum);
+      for (const auto &q : metric.summary.quantile)
+      {
+        std::string quantile;
+        writeDouble(quantile, 1, q.quantile);
+        writeDouble(quantile, 2, q.value);
+        writeBytes(value, 3, quantile);
+      }
+      writeBytes(out, 4, value);
+      break;
+    case prometheus::MetricType::Histogram:
+      writeVarintField(value, 1, metric.histogram.sample_count);
+      writeDouble(value, 2, metric.histogram.sample_sum);
+      for (const auto &b : metric.histogram.bucket)
+      {
+        std::string bucket;
+        writeVarintField(bucket, 1, b.cumulative_count);
+        writeDouble(bucket, 2, b.upper_bound);
+        writeBytes(value, 3, bucket);
+      }
+      writeBytes(out, 7, value);
+      break;
+    default:
+      writeDouble(value, 1, metric.untyped.value);
+      writeBytes(out, 5, value);
+      break;
+    }
+    if (metric.timestamp_ms != 0)
+      writeVarintField(out, 6, (uint64_t)metric.timestamp_ms);
+    return out;
+  }
+
+  // MetricType enum of metrics.proto.
+  uint64_t encodeType(prometheus::MetricType type)
+  {
+    switch (type)
+    {
+    case prometheus::MetricType::Counter:
+      return 0;
+    case prometheus::MetricType::Gauge:
+      return 1;
+    case prometheus::MetricType::Summary:
+      return 2;
+    case prometheus::MetricType::Histogram:
+      return 4;
+    default:
+      return 3; // UNTYPED
+    }
+  }
+}
+
+// Length-delimited io.prometheus.client.MetricFamily messages.
+std::string serializeProtobuf(const std::vector<prometheus::MetricFamily> &families)
+{
+  using namespace protobuf;
+  std::string out;
+  for (const auto &family : families)
+  {
+    std::string message;
+    writeBytes(message, 1, family.name);
+    if (!family.help.empty())
+      writeBytes(message, 2, family.help);
+    writeVarintField(message, 3, encodeType(family.type));
+    for (const auto &metric : family.metric)
+      writeBytes(message, 4, encodeMetric(metric, family.type));
+    writeVarint(out, message.size());
+    out += message;
+  }
+  return out;
+}
+
+std::string serializeExposition(const std::vector<prometheus::MetricFamily> &families, ExpositionFormat format)
+{
+  switch (format)
+  {
+  case ExpositionFormat::openMetrics:
+    return serializeText(families, true);
+  case ExpositionFormat::protobuf:
+    return serializeProtobuf(families);
+  case ExpositionFormat::text:
+    break;
+  }
+  return serializeText(families, false);
+}
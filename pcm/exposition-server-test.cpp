@@ -0,0 +1,118 @@
+// Tests of the request parsing of the pre-rendered exposition server.
+//
+// Covers what ExpositionServer reads from a request head: the request line,
+// the Connection header, content negotiation and the scrape filter.
+//
+//   make test-exposition
+#include <iostream>
+#include <string>
+#include "exposition-server.h"
+
+int failures = 0;
+int checks = 0;
+
+#define CHECK(condition)                                                         \
+  do                                                                             \
+  {                                                                              \
+    ++checks;                                                                    \
+    if (!(condition))                                                            \
+    {                                                                            \
+      ++failures;                                                                \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": failed: " #condition "\n"; \
+    }                                                                            \
+  } while (0)
+
+void testRequestLine()
+{
+  const ExpositionRequest plain = parseExpositionRequest("GET /metrics HTTP/1.1\r\nHost: localhost");
+  CHECK(plain.method == "GET");
+  CHECK(plain.path == "/metrics");
+  CHECK(plain.query.empty());
+  CHECK(!plain.close);
+
+  const ExpositionRequest query = parseExpositionRequest("GET /metrics?collect[]=iio&level=stack HTTP/1.1\r\n");
+  CHECK(query.path == "/metrics");
+  CHECK(query.query == "collect[]=iio&level=stack");
+
+  CHECK(parseExpositionRequest("POST /metrics HTTP/1.1").method == "POST");
+  CHECK(parseExpositionRequest("GET /metricsx HTTP/1.1").path == "/metricsx");
+  CHECK(parseExpositionRequest("GET / HTTP/1.1").path == "/");
+  CHECK(parseExpositionRequest("").path.empty());
+  CHECK(parseExpositionRequest("GET").path.empty());
+}
+
+void testConnection()
+{
+  CHECK(parseExpositionRequest("GET /metrics HTTP/1.1\r\nConnection: close").close);
+  CHECK(parseExpositionRequest("GET /metrics HTTP/1.1\r\nconnection: close").close);
+  CHECK(parseExpositionRequest("GET /metrics HTTP/1.1\r\nCONNECTION: Close").close);
+  CHECK(parseExpositionRequest("GET /metrics HTTP/1.1\r\nConnection:close").close);
+  CHECK(parseExpositionRequest("GET /metrics HTTP/1.1\r\nConnection: \tclose \r\nHost: x").close);
+  CHECK(parseExpositionRequest("GET /metrics HTTP/1.1\r\nConnection: TE, close").close);
+  CHECK(parseExpositionRequest("GET /metrics HTTP/1.1\r\nConnection: TE\r\nConnection: close").close);
+  CHECK(!parseExpositionRequest("GET /metrics HTTP/1.1\r\nConnection: keep-alive").close);
+  CHECK(!parseExpositionRequest("GET /metrics HTTP/1.1\r\nConnection: closed").close);
+  CHECK(!parseExpositionRequest("GET /metrics HTTP/1.1\r\nX-Connection: close").close);
+  CHECK(!parseExpositionRequest("GET /metrics HTTP/1.1\r\nX-Reason: Connection: close").close);
+  // HTTP/1.0 closes unless the client asks for keep-alive
+  CHECK(parseExpositionRequest("GET /metrics HTTP/1.0").close);
+  CHECK(!parseExpositionRequest("GET /metrics HTTP/1.0\r\nConnection: Keep-Alive").close);
+}
+
+void testHeaders()
+{
+  CHECK(httpHeader("GET / HTTP/1.1\r\nAccept-Encoding: gzip", "accept-encoding") == "gzip");
+  CHECK(httpHeader("GET / HTTP/1.1\r\nACCEPT-ENCODING:gzip \r\n", "accept-encoding") == "gzip");
+  CHECK(httpHeader("GET / HTTP/1.1\r\nAccept: a\r\nAccept: b", "accept") == "a,b");
+  CHECK(httpHeader("GET / HTTP/1.1\r\nAccept-Encoding: gzip", "accept").empty());
+  CHECK(httpHeader("GET /accept: x HTTP/1.1", "accept").empty());
+}
+
+void testEncoding()
+{
+  CHECK(acceptsEncoding("GET /metrics HTTP/1.1\r\nAccept-Encoding: gzip, deflate", "gzip"));
+  CHECK(acceptsEncoding("GET /metrics HTTP/1.1\r\naccept-encoding: GZIP", "gzip"));
+  CHECK(acceptsEncoding("GET /metrics HTTP/1.1\r\nAccept-Encoding: *", "zstd"));
+  CHECK(!acceptsEncoding("GET /metrics HTTP/1.1\r\nAccept-Encoding: gzip;q=0", "gzip"));
+  CHECK(!acceptsEncoding("GET /metrics HTTP/1.1\r\nAccept-Encoding: identity", "gzip"));
+  CHECK(!acceptsEncoding("GET /metrics HTTP/1.1", "gzip"));
+}
+
+void testFormat()
+{
+  CHECK(negotiateExpositionFormat("GET /metrics HTTP/1.1") == ExpositionFormat::text);
+  CHECK(negotiateExpositionFormat("GET /metrics HTTP/1.1\r\nAccept: text/plain") == ExpositionFormat::text);
+  CHECK(negotiateExpositionFormat("GET /metrics HTTP/1.1\r\nACCEPT: application/openmetrics-text;version=1.0.0") == ExpositionFormat::openMetrics);
+  CHECK(negotiateExpositionFormat("GET /metrics HTTP/1.1\r\nAccept: application/vnd.google.protobuf;proto=io.prometheus.client.MetricFamily;encoding=delimited;q=0.7,"
+                                  "application/openmetrics-text;version=1.0.0;q=0.5,text/plain;q=0.1") == ExpositionFormat::protobuf);
+}
+
+void testFilter()
+{
+  ExpositionFilter filter;
+  std::string error;
+  CHECK(filter.parse("", error) && filter.empty());
+  CHECK(filter.parse("collect%5B%5D=iio&level=stack,socket", error));
+  CHECK(filter.collectors.count("iio") == 1);
+  CHECK(filter.levels.count("stack") == 1 && filter.levels.count("socket") == 1);
+
+  ExpositionFilter node;
+  CHECK(node.parse("level=node", error) && node.levels.count("system") == 1);
+  CHECK(node.key() == "l=system&");
+
+  ExpositionFilter unknown;
+  CHECK(!unknown.parse("level=rack", error));
+  CHECK(!error.empty());
+}
+
+int main()
+{
+  testRequestLine();
+  testConnection();
+  testHeaders();
+  testEncoding();
+  testFormat();
+  testFilter();
+  std::cout << checks << " checks, " << failures << " failed\n";
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,629 @@
+#pragma once
+// Pre-rendered metrics exposition.
+//
+// prometheus-cpp's Exposer collects every registered family and serializes
+// the text format on every scrape, although the values only change once per
+// sampling cycle. With -exposition=prerendered the sampler renders the whole
+// response (headers and body) once per cycle into an immutable buffer; a small
+// HTTP server sends that buffer to every scraper without collecting,
+// serializing or allocating. The default -exposition=live keeps the
+// prometheus-cpp Exposer.
+//
+// The body is compressed with gzip and, when built with PCM_EXPORTER_ZSTD,
+// zstd on the first request for that encoding in a cycle and cached until the
+// next one; the encoding is negotiated per request from Accept-Encoding (zstd,
+// then gzip, then identity). The format of exposition-formats.h is negotiated
+// from Accept; the sampler only renders the text format, OpenMetrics and
+// protobuf are rendered on their first request in a cycle and cached. Filtered
+// scrapes (exposition-filter.h) are rendered from the families of the cycle on
+// first request and cached until the next cycle.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef PCM_EXPORTER_ZSTD
+#include <zstd.h>
+#endif
+
+#include <prometheus/collectable.h>
+#include <prometheus/exposer.h>
+
+#include "exposition-formats.h"
+#include "exposition-filter.h"
+#include "sparse-exposition.h"
+
+bool prerenderedExposition = false;
+
+// -exposition=prerendered|live
+bool parseExpositionArg(const char *arg)
+{
+  const std::string prefix = "-exposition=";
+  const std::string value(arg);
+  if (value.compare(0, prefix.size(), prefix) != 0)
+    return false;
+  const std::string mode = value.substr(prefix.size());
+  if (mode == "prerendered")
+    prerenderedExposition = true;
+  else if (mode == "live")
+    prerenderedExposition = false;
+  else
+  {
+    std::cerr << "Invalid exposition mode: " << mode << " (prerendered or live)\n";
+    exit(EXIT_FAILURE);
+  }
+  return true;
+}
+
+void print_exposition_options_help()
+{
+  std::cout << "  -exposition=<live|prerendered>     => render /metrics on every scrape (default) or once per sampling cycle\n";
+  print_sparse_options_help();
+}
+
+// gzip stream of <data>; empty if zlib fails.
+std::string gzipCompress(const std::string &data, int level = Z_DEFAULT_COMPRESSION)
+{
+  z_stream stream{};
+  if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return std::string();
+  std::string out(deflateBound(&stream, (uLong)data.size()), '\0');
+  stream.next_in = (Bytef *)data.data();
+  stream.avail_in = (uInt)data.size();
+  stream.next_out = (Bytef *)&out[0];
+  stream.avail_out = (uInt)out.size();
+  const int rc = deflate(&stream, Z_FINISH);
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+  return rc == Z_STREAM_END ? out : std::string();
+}
+
+#ifdef PCM_EXPORTER_ZSTD
+std::string zstdCompress(const std::string &data, int level = 3)
+{
+  std::string out(ZSTD_compressBound(data.size()), '\0');
+  const size_t size = ZSTD_compress(&out[0], out.size(), data.data(), data.size(), level);
+  if (ZSTD_isError(size))
+    return std::string();
+  out.resize(size);
+  return out;
+}
+#endif
+
+/*
+ * Whether the Accept-Encoding header in <head> (request line and headers)
+ * allows <coding>, either by name or by "*", with a non-zero q value.
+ */
+bool acceptsEncoding(const std::string &head, const std::string &coding)
+{
+  std::string lower(head);
+  std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c)
+                 { return (char)std::tolower(c); });
+  const std::string name = "\r\naccept-encoding:";
+  const size_t start = lower.find(name);
+  if (start == std::string::npos)
+    return false;
+  const size_t end = lower.find("\r\n", start + name.size());
+  std::istringstream values(lower.substr(start + name.size(), end == std::string::npos ? std::string::npos : end - start - name.size()));
+  std::string item;
+  while (std::getline(values, item, ','))
+  {
+    const size_t semicolon = item.find(';');
+    std::string token = item.substr(0, semicolon);
+    token.erase(0, token.find_first_not_of(" \t"));
+    token.erase(token.find_last_not_of(" \t") + 1);
+    if (token != coding && token != "*")
+      continue;
+    const size_t q = item.find("q=", semicolon == std::string::npos ? item.size() : semicolon);
+    return q == std::string::npos || atof(item.c_str() + q + 2) > 0.0;
+  }
+  return false;
+}
+
+// Value of the header <name> (lower case) in <head>, repeated headers joined by ','; empty if absent.
+std::string httpHeader(const std::string &head, const std::string &name)
+{
+  std::string value;
+  std::istringstream lines(head);
+  std::string line;
+  std::getline(lines, line); // request line
+  while (std::getline(lines, line))
+  {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    const size_t colon = line.find(':');
+    if (colon != name.size())
+      continue;
+    bool match = true;
+    for (size_t i = 0; i < colon && match; ++i)
+      match = std::tolower((unsigned char)line[i]) == name[i];
+    if (!match)
+      continue;
+    std::string field = line.substr(colon + 1);
+    field.erase(0, field.find_first_not_of(" \t"));
+    field.erase(field.find_last_not_of(" \t") + 1);
+    value += value.empty() ? field : "," + field;
+  }
+  return value;
+}
+
+// What the server needs from a request head (request line and headers).
+struct ExpositionRequest
+{
+  std::string method;
+  std::string path;
+  std::string query; // after '?', empty without one
+  bool close = false; // Connection: close, or HTTP/1.0 without Connection: keep-alive
+};
+
+ExpositionRequest parseExpositionRequest(const std::string &head)
+{
+  ExpositionRequest request;
+  // Request line: <method> <path>[?<query>] <version>
+  std::istringstream line(head.substr(0, head.find("\r\n")));
+  std::string uri, version;
+  line >> request.method >> uri >> version;
+  const size_t question = uri.find('?');
+  request.path = uri.substr(0, question);
+  if (question != std::string::npos)
+    request.query = uri.substr(question + 1);
+
+  bool keepAlive = false;
+  std::istringstream tokens(httpHeader(head, "connection"));
+  std::string token;
+  while (std::getline(tokens, token, ','))
+  {
+    token.erase(0, token.find_first_not_of(" \t"));
+    token.erase(token.find_last_not_of(" \t") + 1);
+    std::transform(token.begin(), token.end(), token.begin(), [](unsigned char c)
+                   { return (char)std::tolower(c); });
+    if (token == "close")
+      request.close = true;
+    else if (token == "keep-alive")
+      keepAlive = true;
+  }
+  if (version == "HTTP/1.0" && !keepAlive)
+    request.close = true;
+  return request;
+}
+
+/*
+ * Minimal HTTP/1.1 server for GET /metrics. Every connection gets its own
+ * thread (at most maxConnections, the rest are closed right away) and is kept
+ * alive until the client closes it or stays idle for idleTimeout seconds.
+ * The acceptor joins finished connection threads, the destructor all of them.
+ * accept() errors other than a stop (out of descriptors or memory) are logged
+ * and retried with a backoff, so /metrics outlives a descriptor shortage.
+ */
+class ExpositionServer
+{
+public:
+  static constexpr int maxConnections = 16;
+  static constexpr int idleTimeout = 30;
+
+  // <address> is "host:port" as for prometheus::Exposer.
+  explicit ExpositionServer(const std::string &address)
+  {
+    const size_t colon = address.rfind(':');
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)atoi(address.c_str() + colon + 1));
+    if (colon == std::string::npos || inet_pton(AF_INET, address.substr(0, colon).c_str(), &addr.sin_addr) != 1)
+    {
+      std::cerr << "Invalid listen address: " << address << "\n";
+      exit(EXIT_FAILURE);
+    }
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    const int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (listenFd < 0 || bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd, 64) != 0)
+    {
+      std::cerr << "Cannot listen on " << address << ": " << strerror(errno) << "\n";
+      exit(EXIT_FAILURE);
+    }
+    publish(std::make_shared<const Families>());
+    acceptor = std::thread([this]()
+                           { acceptLoop(); });
+  }
+
+  ~ExpositionServer()
+  {
+    stopping = true;
+    shutdown(listenFd, SHUT_RDWR);
+    if (acceptor.joinable())
+      acceptor.join();
+    close(listenFd);
+    // Connections blocked in recv() or send() return once their socket is shut down.
+    for (auto &worker : workers)
+    {
+      shutdown(worker.fd, SHUT_RDWR);
+      worker.thread.join();
+      close(worker.fd);
+    }
+  }
+
+  typedef std::vector<prometheus::MetricFamily> Families;
+
+  /*
+   * Renders the families of one cycle in the text format and replaces the
+   * served buffers; scrapes in progress keep the previous ones. The families
+   * are kept for the other formats and filtered scrapes.
+   */
+  void publish(const std::shared_ptr<const Families> &families)
+  {
+    std::shared_ptr<Responses> next(new Responses);
+    next->families = families;
+    next->format(ExpositionFormat::text);
+    std::atomic_store(&responses, std::shared_ptr<const Responses>(next));
+  }
+
+private:
+  int listenFd = -1;
+  std::atomic<bool> stopping{false};
+  std::thread acceptor;
+
+  // A connection thread; its socket is closed after the thread is joined.
+  struct Worker
+  {
+    int fd;
+    std::shared_ptr<std::atomic<bool>> done;
+    std::thread thread;
+  };
+  std::vector<Worker> workers; // acceptor thread only, then the destructor
+
+  static constexpr int minBackoffMs = 10;
+  static constexpr int maxBackoffMs = 1000;
+
+  /*
+   * Complete responses of one body per content coding. The compressed ones are
+   * rendered on their first request and empty if compression is not available.
+   */
+  class Encodings
+  {
+  public:
+    Encodings(const std::string &body_, ExpositionFormat format_) : body(body_), format(format_), identityResponse(render(body, format)) {}
+
+    const std::string &identity() const { return identityResponse; }
+
+    const std::string &gzip() const
+    {
+      std::call_once(gzipOnce, [this]()
+                     {
+                       const std::string compressed = gzipCompress(body);
+                       if (!compressed.empty())
+                         gzipResponse = render(compressed, format, "gzip"); });
+      return gzipResponse;
+    }
+
+    const std::string &zstd() const
+    {
+#ifdef PCM_EXPORTER_ZSTD
+      std::call_once(zstdOnce, [this]()
+                     {
+                       const std::string compressed = zstdCompress(body);
+                       if (!compressed.empty())
+                         zstdResponse = render(compressed, format, "zstd"); });
+#endif
+      return zstdResponse;
+    }
+
+  private:
+    const std::string body;
+    const ExpositionFormat format;
+    const std::string identityResponse;
+    mutable std::once_flag gzipOnce, zstdOnce;
+    mutable std::string gzipResponse, zstdResponse;
+  };
+  struct Responses
+  {
+    std::shared_ptr<const Families> families;
+    // Unfiltered responses per format, rendered on first request.
+    mutable std::array<std::once_flag, 3> formatOnce;
+    mutable std::array<std::unique_ptr<const Encodings>, 3> formats;
+
+    const Encodings &format(ExpositionFormat f) const
+    {
+      std::call_once(formatOnce[(size_t)f], [this, f]()
+                     { formats[(size_t)f].reset(new Encodings(serializeExposition(*families, f), f)); });
+      return *formats[(size_t)f];
+    }
+
+    // Filtered scrapes of this cycle by ExpositionFilter::key() and format, rendered on first request.
+    mutable std::mutex mutex;
+    mutable std::map<std::pair<std::string, ExpositionFormat>, std::shared_ptr<const Encodings>> filtered;
+  };
+  std::shared_ptr<const Responses> responses;
+
+  // At most this many filtered variants are cached per cycle, the rest are rendered per scrape.
+  static constexpr size_t maxFiltered = 32;
+
+  // Encodings of <filter> in <format>, from the cache of the cycle if possible.
+  static std::shared_ptr<const Encodings> filtered(const Responses &responses, const ExpositionFilter &filter, ExpositionFormat format)
+  {
+    const auto key = std::make_pair(filter.key(), format);
+    std::lock_guard<std::mutex> lock(responses.mutex);
+    const auto cached = responses.filtered.find(key);
+    if (cached != responses.filtered.end())
+      return cached->second;
+    auto encodings = std::make_shared<const Encodings>(serializeExposition(filter.apply(*responses.families), format), format);
+    if (responses.filtered.size() < maxFiltered)
+      responses.filtered[key] = encodings;
+    return encodings;
+  }
+
+  static std::string render(const std::string &body, ExpositionFormat format, const char *encoding = nullptr)
+  {
+    std::ostringstream out;
+    out << "HTTP/1.1 200 OK\r\n"
+        << "Content-Type: " << expositionContentType(format) << "\r\n"
+        << "Vary: Accept, Accept-Encoding\r\n";
+    if (encoding)
+      out << "Content-Encoding: " << encoding << "\r\n";
+    out << "Content-Length: " << body.size() << "\r\n"
+        << "\r\n"
+        << body;
+    return out.str();
+  }
+
+  static const std::string &negotiate(const Encodings &r, const std::string &head)
+  {
+    if (acceptsEncoding(head, "zstd") && !r.zstd().empty())
+      return r.zstd();
+    if (acceptsEncoding(head, "gzip") && !r.gzip().empty())
+      return r.gzip();
+    return r.identity();
+  }
+
+  static bool sendAll(int fd, const char *data, size_t size)
+  {
+    while (size > 0)
+    {
+      const ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+      if (sent <= 0)
+      {
+        if (sent < 0 && errno == EINTR)
+          continue;
+        return false;
+      }
+      data += sent;
+      size -= (size_t)sent;
+    }
+    return true;
+  }
+
+  // Joins the connection threads that have finished and closes their sockets.
+  void reapWorkers()
+  {
+    auto alive = workers.begin();
+    for (auto worker = workers.begin(); worker != workers.end(); ++worker)
+    {
+      if (*worker->done)
+      {
+        worker->thread.join();
+        close(worker->fd);
+        continue;
+      }
+      if (alive != worker)
+        *alive = std::move(*worker);
+      ++alive;
+    }
+    workers.erase(alive, workers.end());
+  }
+
+  void acceptLoop()
+  {
+    int backoffMs = 0;
+    while (!stopping)
+    {
+      const int fd = accept(listenFd, nullptr, nullptr);
+      if (fd < 0)
+      {
+        if (stopping)
+          return;
+        if (errno == EINTR || errno == ECONNABORTED)
+          continue;
+        // EMFILE, ENFILE, ENOBUFS, ENOMEM: wait for connections to finish and retry.
+        if (backoffMs == 0)
+          std::cerr << "[WARNING] accept() on the metrics endpoint failed: " << strerror(errno) << ", retrying\n";
+        backoffMs = backoffMs == 0 ? minBackoffMs : (std::min)(2 * backoffMs, maxBackoffMs);
+        std::this_thread::sleep_for(std::chrono::milliseconds(backoffMs));
+        reapWorkers();
+        continue;
+      }
+      if (backoffMs != 0)
+      {
+        std::cerr << "[INFO] accept() on the metrics endpoint recovered\n";
+        backoffMs = 0;
+      }
+      reapWorkers();
+      if (workers.size() >= (size_t)maxConnections)
+      {
+        close(fd);
+        continue;
+      }
+      auto done = std::make_shared<std::atomic<bool>>(false);
+      workers.push_back(Worker{fd, done, std::thread([this, fd, done]()
+                                                     { serve(fd); *done = true; })});
+    }
+  }
+
+  // Serves the requests of one connection; the caller closes <fd>.
+  void serve(int fd)
+  {
+    timeval timeout{idleTimeout, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    std::string request;
+    char buffer[4096];
+    while (!stopping)
+    {
+      const size_t end = request.find("\r\n\r\n");
+      if (end == std::string::npos)
+      {
+        if (request.size() > 16384)
+          break;
+        const ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+          break;
+        request.append(buffer, (size_t)n);
+        continue;
+      }
+      const std::string head = request.substr(0, end);
+      request.erase(0, end + 4);
+
+      const ExpositionRequest parsed = parseExpositionRequest(head);
+      ExpositionFilter filter;
+      std::string error;
+      if (parsed.method != "GET" || parsed.path != "/metrics")
+      {
+        static const char notFound[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+        if (!sendAll(fd, notFound, sizeof(notFound) - 1))
+          break;
+      }
+      else if (!filter.parse(parsed.query, error))
+      {
+        error += "\n";
+        const std::string response = "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain\r\nContent-Length: " + std::to_string(error.size()) + "\r\n\r\n" + error;
+        if (!sendAll(fd, response.data(), response.size()))
+          break;
+      }
+      else
+      {
+        const auto current = std::atomic_load(&responses);
+        const ExpositionFormat format = negotiateExpositionFormat(head);
+        // Keeps a filtered variant alive while it is sent.
+        std::shared_ptr<const Encodings> variant;
+        if (!filter.empty())
+          variant = filtered(*current, filter, format);
+        const std::string &response = negotiate(variant ? *variant : current->format(format), head);
+        if (!sendAll(fd, response.data(), response.size()))
+          break;
+      }
+      if (parsed.close)
+        break;
+    }
+  }
+};
+
+// Serves a collectable in the 0.0.4 text format, which the exporters keep free of timestamps.
+class UntimedCollectable : public prometheus::Collectable
+{
+public:
+  explicit UntimedCollectable(const std::weak_ptr<prometheus::Collectable> &collectable_) : collectable(collectable_) {}
+
+  std::vector<prometheus::MetricFamily> Collect() const override
+  {
+    const auto locked = collectable.lock();
+    if (!locked)
+      return {};
+    auto families = locked->Collect();
+    for (auto &family : families)
+    {
+      for (auto &metric : family.metric)
+        metric.timestamp_ms = 0;
+    }
+    return families;
+  }
+
+private:
+  std::weak_ptr<prometheus::Collectable> collectable;
+};
+
+/*
+ * The metrics endpoint of an exporter: either the prometheus-cpp Exposer
+ * (-exposition=live, 0.0.4 text only) or the pre-rendered ExpositionServer, in
+ * which case the sampler calls publish() at the end of every cycle.
+ */
+class MetricsEndpoint
+{
+public:
+  typedef std::chrono::steady_clock clock;
+
+  explicit MetricsEndpoint(const std::string &address)
+  {
+    if (prerenderedExposition)
+      server.reset(new ExpositionServer(address));
+    else if (sparseWindows > 0)
+    {
+      std::cerr << "-sparse needs -exposition=prerendered\n";
+      exit(EXIT_FAILURE);
+    }
+    else
+      exposer.reset(new prometheus::Exposer(address));
+    if (sparseWindows > 0)
+      sparse.reset(new SparseExposition(sparseWindows));
+  }
+
+  void RegisterCollectable(const std::weak_ptr<prometheus::Collectable> &collectable)
+  {
+    if (exposer)
+    {
+      untimed.push_back(std::make_shared<UntimedCollectable>(collectable));
+      exposer->RegisterCollectable(untimed.back());
+    }
+    else
+      collectables.push_back(collectable);
+  }
+
+  // With -sparse, exports the series of <companion> only with the series of <primary> that has the same labels.
+  void sparseFollow(const std::string &companion, const std::string &primary)
+  {
+    if (sparse)
+      sparse->follow(companion, primary);
+  }
+
+  /*
+   * Renders all collectables into the served buffers. Samples without a
+   * timestamp of their own get <windowEnd>, the end of the sampling window the
+   * cycle measured, in the OpenMetrics and protobuf formats.
+   */
+  void publish(clock::time_point windowEnd = clock::now())
+  {
+    if (!server)
+      return;
+    std::vector<prometheus::MetricFamily> families;
+    for (const auto &weak : collectables)
+    {
+      if (auto collectable = weak.lock())
+      {
+        auto collected = collectable->Collect();
+        families.insert(families.end(), std::make_move_iterator(collected.begin()), std::make_move_iterator(collected.end()));
+      }
+    }
+    const int64_t timestamp = sampleTimestampMs(windowEnd);
+    for (auto &family : families)
+    {
+      for (auto &metric : family.metric)
+      {
+        if (metric.timestamp_ms == 0)
+          metric.timestamp_ms = timestamp;
+      }
+    }
+    if (sparse)
+      sparse->apply(families);
+    server->publish(std::make_shared<const ExpositionServer::Families>(std::move(families)));
+  }
+
+private:
+  std::unique_ptr<prometheus::Exposer> exposer;
+  std::unique_ptr<ExpositionServer> server;
+  std::vector<std::weak_ptr<prometheus::Collectable>> collectables;
+  std::vector<std::shared_ptr<UntimedCollectable>> untimed;
+  std::unique_ptr<SparseExposition> sparse;
+};
@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+"""Generates iio-event-tables.h from the opCode-<model>.txt files.
+
+Every event line becomes a constexpr iio_event_def entry whose control register
+value is encoded at compile time (see iio-embedded-events.h), so the exporter
+does not need the opCode files at runtime. Run by the Makefile and build.sh:
+
+    ./gen-iio-event-tables.py iio-event-tables.h opCode-*.txt
+"""
+import os
+import re
+import sys
+
+# CPU models whose IIO PMON control registers use the Skylake-SP layout; the rest use the Icelake-SP one.
+SKX_LAYOUT_MODELS = {85}
+
+CCR_FIELDS = ["ev_sel", "umask", "reset", "edge_det", "overflow_enable", "en", "invert", "thresh", "ch_mask", "fc_mask"]
+IGNORED_FIELDS = {"opcode", "ignored"}
+
+
+def parse_number(value):
+    return int(value, 0)
+
+
+def c_string(value):
+    return '"' + value.replace("\\", "\\\\").replace('"', '\\"') + '"'
+
+
+def parse_file(path):
+    events = []
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+            fields = {}
+            for item in line.split(","):
+                if not item.strip():
+                    continue
+                key, _, value = item.partition("=")
+                key = key.strip()
+                if key in IGNORED_FIELDS:
+                    continue
+                if key not in CCR_FIELDS + ["ctr", "multiplier", "divider", "hname", "vname"]:
+                    sys.exit("%s:%d: unknown field '%s'" % (path, lineno, key))
+                fields[key] = value.strip() if key in ("hname", "vname") else parse_number(value.strip())
+            for required in ("ctr", "hname", "vname"):
+                if required not in fields:
+                    sys.exit("%s:%d: missing field '%s'" % (path, lineno, required))
+            events.append(fields)
+    return events
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit(__doc__)
+    output, inputs = sys.argv[1], sys.argv[2:]
+
+    tables = []
+    for path in sorted(inputs):
+        # Only the per-model files; variants such as opCode-143-accel.txt are selected with -events=.
+        match = re.fullmatch(r"opCode-(\d+)\.txt", os.path.basename(path))
+        if match:
+            tables.append((int(match.group(1)), parse_file(path)))
+
+    out = [
+        "#pragma once",
+        "// Generated by gen-iio-event-tables.py from " + ", ".join("opCode-%d.txt" % model for model, _ in tables) + ". Do not edit.",
+        "",
+        '#include "iio-embedded-events.h"',
+        "",
+    ]
+    for model, events in tables:
+        layout = "iio_ccr_layout::skx" if model in SKX_LAYOUT_MODELS else "iio_ccr_layout::icx"
+        out.append("static constexpr iio_event_def iio_events_%d[] = {" % model)
+        for ev in events:
+            ccr = ", ".join("0x%x" % ev.get(name, 0) for name in CCR_FIELDS)
+            out.append("    make_iio_event(%s, %d, {%s}, %d, %d, %s, %s)," % (
+                layout, ev["ctr"], ccr, ev.get("multiplier", 1), ev.get("divider", 1), c_string(ev["hname"]), c_string(ev["vname"])))
+        out.append("};")
+        out.append("")
+    out.append("static constexpr iio_event_table iio_event_tables[] = {")
+    for model, events in tables:
+        out.append("    {%d, iio_events_%d, sizeof(iio_events_%d) / sizeof(iio_events_%d[0])}," % (model, model, model, model))
+    out.append("};")
+
+    with open(output, "w") as f:
+        f.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()
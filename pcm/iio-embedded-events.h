@@ -0,0 +1,59 @@
+#pragma once
+// IIO event definitions embedded in the binary.
+//
+// gen-iio-event-tables.py turns every opCode-<model>.txt into a constexpr table
+// (iio-event-tables.h) at build time. The PMON control register value of each
+// event is encoded here at compile time, following the skx_ccr / icx_ccr field
+// layouts of PCM, so no ccr object is created per field at startup.
+
+#include <cstddef>
+#include <cstdint>
+
+enum class iio_ccr_layout
+{
+  skx, // Skylake-SP: thresh 24-31, ch_mask 36-43, fc_mask 44-46
+  icx  // Icelake-SP and later: thresh 24-35, ch_mask 36-47, fc_mask 48-50
+};
+
+// Field values as written in the opCode file, in gen-iio-event-tables.py CCR_FIELDS order.
+struct iio_ccr_fields
+{
+  uint64_t ev_sel, umask, reset, edge_det, overflow_enable, enable, invert, thresh, ch_mask, fc_mask;
+};
+
+constexpr uint64_t iio_encode_ccr(iio_ccr_layout layout, const iio_ccr_fields &f)
+{
+  return (f.ev_sel & 0xff) | ((f.umask & 0xff) << 8) | ((f.reset & 0x1) << 17) | ((f.edge_det & 0x1) << 18) |
+         ((f.overflow_enable & 0x1) << 20) | ((f.enable & 0x1) << 22) | ((f.invert & 0x1) << 23) |
+         (layout == iio_ccr_layout::skx
+              ? ((f.thresh & 0xff) << 24) | ((f.ch_mask & 0xff) << 36) | ((f.fc_mask & 0x7) << 44)
+              : ((f.thresh & 0xfff) << 24) | ((f.ch_mask & 0xfff) << 36) | ((f.fc_mask & 0x7) << 48));
+}
+
+struct iio_event_def
+{
+  iio_ccr_layout layout;
+  iio_ccr_fields fields;
+  uint64_t ccr; // encoded control register value
+  int idx;      // counter index (ctr=)
+  int multiplier;
+  int divider;
+  const char *hname;
+  const char *vname;
+};
+
+constexpr iio_event_def make_iio_event(iio_ccr_layout layout, int idx, iio_ccr_fields fields, int multiplier, int divider,
+                                       const char *hname, const char *vname)
+{
+  return iio_event_def{layout, fields, iio_encode_ccr(layout, fields), idx, multiplier, divider, hname, vname};
+}
+
+struct iio_event_table
+{
+  int cpu_model;
+  const iio_event_def *events;
+  size_t count;
+};
+
+static_assert(iio_encode_ccr(iio_ccr_layout::icx, {0x83, 0x1, 0, 0, 0, 0, 0, 0, 0x1, 0x7}) == 0x0007001000000183ULL, "icx ccr layout");
+static_assert(iio_encode_ccr(iio_ccr_layout::skx, {0x83, 0x1, 0, 0, 0, 0, 0, 0, 0x1, 0x7}) == 0x0000701000000183ULL, "skx ccr layout");
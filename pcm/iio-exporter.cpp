@@ -7,15 +7,82 @@
 #include <thread>
 #include <prometheus/exposer.h>
 #include <prometheus/registry.h>
+#include <prometheus/counter.h>
 #include <prometheus/gauge.h>
 #include "cpucounters.h"
 #include "utils.h"
 #include "iio-exporter.h"
+#include "exporter-startup.h"
+#include "snapshot-collectable.h"
 
 using namespace pcm;
 
 PCM_MAIN_NOTHROW;
 
+// (socket, stack) and counter of an exported series
+typedef std::pair<std::pair<uint32_t, uint32_t>, std::pair<h_id, v_id>> iio_series_key;
+
+// Byte counters of a bandwidth series and the sample they were last updated with
+struct iio_byte_counters
+{
+  prometheus::Counter *estimated = nullptr; // extrapolated to the whole time
+  prometheus::Counter *measured = nullptr;  // exact, while the event was measured
+  prometheus::Counter *seconds = nullptr;   // time the event was measured
+  std::chrono::steady_clock::time_point last_sampled;
+};
+
+// part is "Part0".."Part7" or "Total" for per-stack events; event is the hname (IB write, IOTLB Hit, ...).
+prometheus::Labels iio_labels(uint32_t socket_id, uint32_t stack_id, const struct iio_counter &ctr)
+{
+  return {{"socket", std::to_string(socket_id)}, {"stack", std::to_string(stack_id)}, {"part", ctr.v_event_name}, {"event", ctr.h_event_name}};
+}
+
+// Burst mode replaces the multiplexed sampling: the burst events are polled for every export window.
+void run_burst_mode(PCM *m, const std::vector<struct iio_stacks_on_socket> &iios, const vector<struct iio_counter> &ctrs, const double delay,
+                    prometheus::Registry &registry, MetricsEndpoint &endpoint, MainLoop &mainLoop)
+{
+  std::vector<iio_burst_event> events;
+  if (!build_burst_events(ctrs, burstEventNames, events))
+    exit(EXIT_FAILURE);
+
+  auto &pcm_iio_burst_family = prometheus::BuildGauge()
+                                   .Name("pcm_iio_burst")
+                                   .Help("PCM IIO stack bandwidth in bytes per second, quantiles of the burst polls over the interval")
+                                   .Register(registry);
+  auto &pcm_iio_burst_busy = prometheus::BuildGauge()
+                                 .Name("pcm_iio_burst_poll_cpu_ratio")
+                                 .Help("Fraction of the interval the sampling thread spent reading the burst counters")
+                                 .Register(registry)
+                                 .Add({});
+
+  iio_burst_sampler sampler(m, iios, events);
+  sampler.program();
+  std::cout << "[INFO] Burst mode: " << events.size() << " events every " << burstIntervalMs << " ms" << std::endl;
+  std::cout << "\n------\n[INFO] Starting Prometheus exporter on port: 9403" << std::endl;
+
+  mainLoop([&]()
+           {
+        sampler.sample(delay);
+        for (const auto &w : sampler.take_window())
+        {
+          const std::string socket = std::to_string(w.socket_id), stack = std::to_string(w.stack_id);
+          const std::string &event = events[w.event].name;
+          const std::pair<const char *, double> quantiles[] = {{"0.5", w.p50}, {"0.99", w.p99}, {"1", w.max}};
+          for (const auto &q : quantiles)
+          {
+            const prometheus::Labels labels = {{"socket", socket}, {"stack", stack}, {"event", event}, {"quantile", q.first}};
+            // A window without polls (shorter than the burst interval) has no quantiles; do not leave the previous ones.
+            if (w.polls > 0)
+              pcm_iio_burst_family.Add(labels).Set(q.second);
+            else if (pcm_iio_burst_family.Has(labels))
+              pcm_iio_burst_family.Remove(&pcm_iio_burst_family.Add(labels));
+          }
+        }
+        pcm_iio_burst_busy.Set(sampler.take_busy() / delay);
+        endpoint.publish();
+        return true; });
+}
+
 int mainThrows(int argc, char *argv[])
 {
   if (print_version(argc, argv))
@@ -38,15 +105,122 @@ int mainThrows(int argc, char *argv[])
   iio_evt_parse_context evt_ctx;
   // Map with metrics names.
   map<string, std::pair<h_id, std::map<string, v_id>>> nameMap;
+  // Sampling periods per event class or hname.
+  map<string, double> periods;
+  // Overrides the built-in event table.
+  std::string events_file;
+  // Discovered topology is reused from this file when it is still valid.
+  std::string topology_cache;
+
+  while (argc > 1)
+  {
+    argv++;
+    argc--;
+    std::string arg_value;
+    if (check_argument_equals(*argv, {"--help", "-h", "/h"}))
+    {
+      print_usage(program);
+      exit(EXIT_FAILURE);
+    }
+    else if (check_argument_equals(*argv, {"-list", "--list"}))
+    {
+      list = true;
+    }
+    else if (extract_argument_value(*argv, {"-period", "/period"}, arg_value))
+    {
+      string name;
+      double period;
+      if (!parsePeriodSpec(arg_value, name, period))
+      {
+        cerr << "Invalid period: " << arg_value << "\n";
+        print_usage(program);
+        exit(EXIT_FAILURE);
+      }
+      periods[name] = period;
+    }
+    else if (extract_argument_value(*argv, {"-events", "/events"}, arg_value))
+    {
+      events_file = arg_value;
+    }
+    else if (extract_argument_value(*argv, {"-topology-cache", "/topology-cache"}, arg_value))
+    {
+      topology_cache = arg_value;
+    }
+    else if (check_argument_equals(*argv, {"-all", "/all"}))
+    {
+      pruneTopology = false;
+    }
+    else if (check_argument_equals(*argv, {"-adaptive", "/adaptive"}))
+    {
+      adaptiveMultiplexing = true;
+    }
+    else if (extract_argument_value(*argv, {"-burst", "/burst"}, arg_value))
+    {
+      const int interval = atoi(arg_value.c_str());
+      if (interval < (int)minBurstIntervalMs || interval > (int)maxBurstIntervalMs)
+      {
+        cerr << "Invalid burst interval: " << arg_value << " (" << minBurstIntervalMs << "-" << maxBurstIntervalMs << " ms)\n";
+        exit(EXIT_FAILURE);
+      }
+      burstIntervalMs = (uint32_t)interval;
+    }
+    else if (extract_argument_value(*argv, {"-burst-events", "/burst-events"}, arg_value))
+    {
+      if (!parse_burst_events(arg_value, burstEventNames))
+      {
+        cerr << "Invalid burst events: " << arg_value << " (1 to 4 event names)\n";
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if (extract_argument_value(*argv, {"-levels", "/levels"}, arg_value))
+    {
+      if (!parse_iio_levels(arg_value, iioLevels))
+      {
+        cerr << "Invalid levels: " << arg_value << " (part, stack, socket, system or node)\n";
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if (extract_argument_value(*argv, {"-min-revisit", "/min-revisit"}, arg_value))
+    {
+      minRevisitCycles = (std::max)(1, atoi(arg_value.c_str()));
+    }
+    else if (parsePciDiscoveryArg(*argv))
+    {
+      continue;
+    }
+    else if (parseDiscoveryThreadsArg(*argv))
+    {
+      continue;
+    }
+    else if (parseAffinityArg(*argv) || parseSummaryWindowArg(*argv) || parseExpositionArg(*argv) || parseSparseArg(*argv))
+    {
+      continue;
+    }
+    else if (mainLoop.parseArg(*argv))
+    {
+      continue;
+    }
+    else
+    {
+      delay = parse_delay(*argv, program, (print_usage_func)print_usage);
+      continue;
+    }
+  }
+
+  // Must precede the creation of the HTTP server threads, they inherit the mask.
+  if (!applyHousekeepingAffinity())
+    exit(EXIT_FAILURE);
 
   set_signal_handlers();
 
   // print_cpu_details();
 
+  StartupTimer startup;
   PCM *m = PCM::getInstance();
+  startup.mark("pcm_init");
 
-  PCIDB pciDB;
-  load_PCIDB(pciDB);
+  // Names are only resolved for -list, on first use.
+  PciIdDatabase pciDB;
 
   auto mapping = IPlatformMapping::getPlatformMapping(m->getCPUFamilyModel(), m->getNumSockets());
   if (!mapping)
@@ -56,10 +230,11 @@ int mainThrows(int argc, char *argv[])
   }
 
   std::vector<struct iio_stacks_on_socket> iios;
-  if (!mapping->pciTreeDiscover(iios))
+  if (!discover_iio_topology(m, *mapping, topology_cache, iios))
   {
     exit(EXIT_FAILURE);
   }
+  startup.mark("pci_discovery");
 
   std::ostream *output = &std::cout;
   std::fstream file_stream;
@@ -75,42 +250,19 @@ int mainThrows(int argc, char *argv[])
     return 0;
   }
 
-  string ev_file_name;
-  if (m->IIOEventsAvailable())
-  {
-    ev_file_name = "opCode-" + std::to_string(m->getCPUFamilyModel()) + ".txt";
-  }
-  else
+  prune_iio_topology(iios);
+  startup.mark("topology_pruning");
+
+  if (!m->IIOEventsAvailable())
   {
     cerr << "This CPU is not supported by PCM IIO tool! Program aborted\n";
     exit(EXIT_FAILURE);
   }
 
-  map<string, uint32_t> opcodeFieldMap;
-  opcodeFieldMap["opcode"] = PCM::OPCODE;
-  opcodeFieldMap["ev_sel"] = PCM::EVENT_SELECT;
-  opcodeFieldMap["umask"] = PCM::UMASK;
-  opcodeFieldMap["reset"] = PCM::RESET;
-  opcodeFieldMap["edge_det"] = PCM::EDGE_DET;
-  opcodeFieldMap["ignored"] = PCM::IGNORED;
-  opcodeFieldMap["overflow_enable"] = PCM::OVERFLOW_ENABLE;
-  opcodeFieldMap["en"] = PCM::ENABLE;
-  opcodeFieldMap["invert"] = PCM::INVERT;
-  opcodeFieldMap["thresh"] = PCM::THRESH;
-  opcodeFieldMap["ch_mask"] = PCM::CH_MASK;
-  opcodeFieldMap["fc_mask"] = PCM::FC_MASK;
-  opcodeFieldMap["hname"] = PCM::H_EVENT_NAME;
-  opcodeFieldMap["vname"] = PCM::V_EVENT_NAME;
-  opcodeFieldMap["multiplier"] = PCM::MULTIPLIER;
-  opcodeFieldMap["divider"] = PCM::DIVIDER;
-  opcodeFieldMap["ctr"] = PCM::COUNTER_INDEX;
-
-  evt_ctx.m = m;
-  evt_ctx.ctrs.clear(); // fill the ctrs by evt_handler call back func.
-
   try
   {
-    load_events(ev_file_name, opcodeFieldMap, iio_evt_parse_handler, (void *)&evt_ctx, nameMap);
+    const string source = load_iio_event_definitions(m, events_file, evt_ctx, nameMap);
+    std::cout << "[INFO] Loaded " << evt_ctx.ctrs.size() << " IIO events (" << source << ")" << std::endl;
   }
   catch (std::exception &e)
   {
@@ -118,24 +270,92 @@ int mainThrows(int argc, char *argv[])
     std::cerr << "Event configure file have the problem and cause the program exit, please double check it!\n";
     exit(EXIT_FAILURE);
   }
+  startup.mark("load_events");
+
+  if (!check_period_names(evt_ctx.ctrs, periods))
+    exit(EXIT_FAILURE);
+
+  const size_t all_ctrs = evt_ctx.ctrs.size();
+  prune_iio_counters(evt_ctx.ctrs);
+  if (evt_ctx.ctrs.size() != all_ctrs)
+  {
+    std::cout << "[INFO] Pruned " << all_ctrs - evt_ctx.ctrs.size() << " of " << all_ctrs << " counters for parts without devices" << std::endl;
+  }
 
   results.resize(m->getNumSockets(), stack_content(m->getMaxNumOfIIOStacks(), ctr_data()));
+  series_stats.resize(m->getNumSockets(), std::vector<std::map<std::pair<h_id, v_id>, iio_series_stats>>(m->getMaxNumOfIIOStacks()));
+  series_totals.resize(m->getNumSockets(), std::vector<std::map<std::pair<h_id, v_id>, CounterAccumulator>>(m->getMaxNumOfIIOStacks()));
+
+  MultiRateSchedule schedule;
+  const auto event_groups = build_event_groups(evt_ctx.ctrs, periods, delay, schedule);
+  for (size_t i = 0; i < schedule.size(); ++i)
+  {
+    std::cout << "[INFO] " << schedule.entry(i).name << ": " << event_groups[i].ctrs.size() << " counters every " << schedule.entry(i).period << " s" << std::endl;
+  }
+  startup.mark("setup");
 
   // Prometheus definition
   // Create a Prometheus exporter
-  prometheus::Exposer exposer{"0.0.0.0:9403"};
+  MetricsEndpoint exposer{"0.0.0.0:9403"};
 
   // Create a metrics registry
   auto registry = std::make_shared<prometheus::Registry>();
 
   // Add the metrics registry to the exposer
   exposer.RegisterCollectable(registry);
+  startup.mark("exposer");
+  startup.print(std::cout);
+  startup.publish(*registry);
+
+  if (burstIntervalMs > 0)
+  {
+    run_burst_mode(m, iios, evt_ctx.ctrs, delay, *registry, exposer, mainLoop);
+    exit(EXIT_SUCCESS);
+  }
+
+  // Per-series gauges, written by index into one snapshot; all four families share the label table
+  auto pcm_iio_snapshot = std::make_shared<SnapshotCollectable>();
+  exposer.RegisterCollectable(pcm_iio_snapshot);
+  const size_t pcm_iio_value = pcm_iio_snapshot->addFamily("pcm_iio", "PCM IIO in bytes per second");
+  const size_t pcm_iio_coverage = pcm_iio_snapshot->addFamily("pcm_iio_coverage_ratio", "Fraction of wall time the PCM IIO event was measured (multiplexing duty cycle)");
+  const size_t pcm_iio_variance = pcm_iio_snapshot->addFamily("pcm_iio_variance", "Moving variance of the PCM IIO extrapolated rate in (bytes per second)^2");
+  const size_t pcm_iio_error = pcm_iio_snapshot->addFamily("pcm_iio_relative_error", "Estimated relative error of the PCM IIO extrapolated rate");
+  // The estimate quality of a series is exported as long as its value is
+  exposer.sparseFollow("pcm_iio_coverage_ratio", "pcm_iio");
+  exposer.sparseFollow("pcm_iio_variance", "pcm_iio");
+  exposer.sparseFollow("pcm_iio_relative_error", "pcm_iio");
 
-  // Create gauge metrics for PCIe bandwidths
-  auto &pcm_iio_family = prometheus::BuildGauge()
-                             .Name("pcm_iio")
-                             .Help("PCM IIO in bytes per second")
-                             .Register(*registry);
+  // Bandwidth events (per-part payload) integrated into byte counters: the exact measured total and an estimate of all bytes
+  auto &pcm_iio_bytes_family = prometheus::BuildCounter()
+                                   .Name("pcm_iio_bytes_total")
+                                   .Help("PCM IIO bytes, estimated: extrapolated over the time the event was not measured")
+                                   .Register(*registry);
+  auto &pcm_iio_measured_bytes_family = prometheus::BuildCounter()
+                                            .Name("pcm_iio_measured_bytes_total")
+                                            .Help("PCM IIO bytes counted while the event was measured (exact)")
+                                            .Register(*registry);
+  auto &pcm_iio_measured_seconds_family = prometheus::BuildCounter()
+                                              .Name("pcm_iio_measured_seconds_total")
+                                              .Help("Time the PCM IIO event was measured in seconds")
+                                              .Register(*registry);
+  std::map<iio_series_key, iio_byte_counters> pcm_iio_bytes;
+
+  // ... and summarized over the window, with the time of the last sample observed; the window holds samples of the slowest bandwidth event
+  double pcm_iio_window_period = delay;
+  for (const auto &ctr : evt_ctx.ctrs)
+  {
+    if (iio_event_class(ctr) == "bandwidth")
+      pcm_iio_window_period = (std::max)(pcm_iio_window_period, iio_counter_period(ctr, periods, delay));
+  }
+  auto pcm_iio_window = std::make_shared<WindowSummary>("pcm_iio_window", "PCM IIO in bytes per second, summary of the samples over the window",
+                                                        summaryWindowFor(pcm_iio_window_period));
+  exposer.RegisterCollectable(pcm_iio_window);
+  std::map<iio_series_key, std::pair<size_t, std::chrono::steady_clock::time_point>> pcm_iio_window_series;
+
+  // Measured series only with their level (iio_measured_exported); the rollups of every active series, in the update loop's order
+  std::map<prometheus::Labels, size_t> pcm_iio_rollups;
+  std::vector<std::vector<prometheus::Labels>> pcm_iio_rollup_labels;
+  std::vector<std::vector<size_t>> pcm_iio_rollup_targets;
 
   // Add metrics to the registry
   for (const auto &socket : iios)
@@ -146,20 +366,83 @@ int mainThrows(int argc, char *argv[])
 
       for (const auto &ctr : evt_ctx.ctrs)
       {
-        std::string metric_name = "socket" + std::to_string(socket.socket_id) + "_stack" + std::to_string(stack_id) + "_" + ctr.v_event_name;
-        pcm_iio_family.Add({{"socket", std::to_string(socket.socket_id)}, {"stack", std::to_string(stack_id)}, {"event", ctr.v_event_name}});
+        if (!iio_series_active(socket.socket_id, stack_id, ctr))
+          continue;
+        // The update loop below visits the active series in the same order.
+        if (iio_measured_exported(ctr, iioLevels))
+        {
+          prometheus::Labels labels = iio_labels(socket.socket_id, stack_id, ctr);
+          labels["level"] = iio_level_names[iio_measured_level(ctr)];
+          pcm_iio_snapshot->addSeries(labels);
+        }
+        std::vector<prometheus::Labels> rollups;
+        // A per-stack counter is its own stack series
+        if ((iioLevels & (1u << iio_level_stack)) && iio_counter_part(ctr) >= 0)
+          rollups.push_back({{"socket", std::to_string(socket.socket_id)}, {"stack", std::to_string(stack_id)}, {"event", ctr.h_event_name}, {"level", "stack"}});
+        if (iioLevels & (1u << iio_level_socket))
+          rollups.push_back({{"socket", std::to_string(socket.socket_id)}, {"event", ctr.h_event_name}, {"level", "socket"}});
+        if (iioLevels & (1u << iio_level_system))
+          rollups.push_back({{"event", ctr.h_event_name}, {"level", "system"}});
+        for (const auto &labels : rollups)
+          pcm_iio_rollups[labels] = 0;
+        pcm_iio_rollup_labels.push_back(std::move(rollups));
+        if (iio_event_class(ctr) == "bandwidth")
+        {
+          const iio_series_key key(std::make_pair(socket.socket_id, stack_id), std::pair<h_id, v_id>(ctr.h_id, ctr.v_id));
+          auto &bytes = pcm_iio_bytes[key];
+          bytes.estimated = &pcm_iio_bytes_family.Add(iio_labels(socket.socket_id, stack_id, ctr));
+          bytes.measured = &pcm_iio_measured_bytes_family.Add(iio_labels(socket.socket_id, stack_id, ctr));
+          bytes.seconds = &pcm_iio_measured_seconds_family.Add(iio_labels(socket.socket_id, stack_id, ctr));
+          pcm_iio_window_series[key].first = pcm_iio_window->add(iio_labels(socket.socket_id, stack_id, ctr));
+        }
+      }
+    }
+  }
+
+  // Rollup series follow the measured ones in the snapshot
+  for (auto &rollup : pcm_iio_rollups)
+    rollup.second = pcm_iio_snapshot->addSeries(rollup.first);
+  for (const auto &rollups : pcm_iio_rollup_labels)
+  {
+    pcm_iio_rollup_targets.emplace_back();
+    for (const auto &labels : rollups)
+      pcm_iio_rollup_targets.back().push_back(pcm_iio_rollups[labels]);
+  }
+
+  // Stack totals of the payload events (IB/OB read/write), one observation once every part of the event has a new sample
+  auto &pcm_iio_stack_family = prometheus::BuildHistogram()
+                                   .Name("pcm_iio_stack_bandwidth_bytes_per_second")
+                                   .Help("PCM IIO stack bandwidth in bytes per second, one observation per new sample of every part of the event")
+                                   .Register(*registry);
+  std::map<std::pair<std::pair<uint32_t, uint32_t>, std::string>, prometheus::Histogram *> pcm_iio_stack_hist;
+  // Sample of each counter in the last observation
+  std::vector<std::chrono::steady_clock::time_point> pcm_iio_stack_observed(evt_ctx.ctrs.size());
+  for (const auto &socket : iios)
+  {
+    for (const auto &stack : socket.stacks)
+    {
+      for (const auto &ctr : evt_ctx.ctrs)
+      {
+        const auto key = std::make_pair(std::make_pair(socket.socket_id, stack.iio_unit_id), ctr.h_event_name);
+        if (iio_event_class(ctr) != "bandwidth" || pcm_iio_stack_hist.count(key))
+          continue;
+        pcm_iio_stack_hist[key] = &pcm_iio_stack_family.Add({{"socket", std::to_string(socket.socket_id)}, {"stack", std::to_string(stack.iio_unit_id)}, {"event", ctr.h_event_name}},
+                                                            bandwidthBuckets());
       }
     }
   }
 
   // Start the Prometheus exporter
   std::cout << "\n------\n[INFO] Starting Prometheus exporter on port: 9403" << std::endl;
+  exposer.publish();
 
   mainLoop([&]()
            {
-        collect_data(m, delay, iios, evt_ctx.ctrs);
+        collect_data(m, delay, iios, evt_ctx.ctrs, event_groups, schedule);
 
         // Update the Prometheus metrics
+        size_t series = 0, active = 0;
+        std::vector<double> rollup_sums(pcm_iio_snapshot->seriesCount(), 0.0);
         for (const auto &socket : iios)
         {
           for (const auto &stack : socket.stacks)
@@ -168,11 +451,93 @@ int mainThrows(int argc, char *argv[])
 
             for (const auto &ctr : evt_ctx.ctrs)
             {
-              const uint64_t value = results[socket.socket_id][stack_id][std::pair<h_id, v_id>(ctr.h_id, ctr.v_id)];
-              pcm_iio_family.Add({{"socket", std::to_string(socket.socket_id)}, {"stack", std::to_string(stack_id)}, {"event", ctr.v_event_name}}).Set(value);
+              if (!iio_series_active(socket.socket_id, stack_id, ctr))
+                continue;
+              const auto key = std::pair<h_id, v_id>(ctr.h_id, ctr.v_id);
+              const double value = iio_series_rate(socket.socket_id, stack_id, ctr);
+              for (const size_t rollup : pcm_iio_rollup_targets[active++])
+                rollup_sums[rollup] += value;
+
+              const auto acc = series_totals[socket.socket_id][stack_id].find(key);
+              if (iio_measured_exported(ctr, iioLevels))
+              {
+                const auto &stats = series_stats[socket.socket_id][stack_id][key];
+                pcm_iio_snapshot->set(pcm_iio_value, series, value);
+                pcm_iio_snapshot->set(pcm_iio_coverage, series, stats.coverage);
+                pcm_iio_snapshot->set(pcm_iio_variance, series, stats.variance);
+                pcm_iio_snapshot->set(pcm_iio_error, series, stats.relativeError(estimateAlpha));
+                // The time of the sample, taken when it was measured; it only changes with a new sample.
+                if (ctr.sampled)
+                  pcm_iio_snapshot->stamp(series, ctr.sampled_ms);
+                ++series;
+              }
+
+              // A new sample brings the measured counters to the accumulator's totals, and adds its events to the
+              // estimate, scaled up by its coverage to the time since the previous sample.
+              const auto bytes = pcm_iio_bytes.find(std::make_pair(std::make_pair(socket.socket_id, stack_id), key));
+              if (bytes != pcm_iio_bytes.end() && ctr.sampled && bytes->second.last_sampled != ctr.last_sampled)
+              {
+                const double coverage = series_stats[socket.socket_id][stack_id][key].coverage;
+                if (acc != series_totals[socket.socket_id][stack_id].end())
+                {
+                  bytes->second.measured->Increment(acc->second.total(ctr.multiplier, ctr.divider) - bytes->second.measured->Value());
+                  bytes->second.seconds->Increment(acc->second.measured() - bytes->second.seconds->Value());
+                  if (coverage > 0.0)
+                    bytes->second.estimated->Increment(acc->second.last(ctr.multiplier, ctr.divider) / coverage);
+                }
+                bytes->second.last_sampled = ctr.last_sampled;
+              }
+
+              const auto summary = pcm_iio_window_series.find(std::make_pair(std::make_pair(socket.socket_id, stack_id), key));
+              if (summary != pcm_iio_window_series.end() && ctr.sampled && summary->second.second != ctr.last_sampled)
+              {
+                pcm_iio_window->observe(summary->second.first, value);
+                summary->second.second = ctr.last_sampled;
+              }
+            }
+          }
+        }
+
+        for (const auto &rollup : pcm_iio_rollups)
+          pcm_iio_snapshot->set(pcm_iio_value, rollup.second, rollup_sums[rollup.second]);
+
+        // Every part of an event has its own slice, and -adaptive skips idle parts in some cycles. The
+        // stack totals are observed once every part has been sampled again since the previous observation.
+        std::map<std::string, bool> complete;
+        for (size_t i = 0; i < evt_ctx.ctrs.size(); ++i)
+        {
+          const auto &ctr = evt_ctx.ctrs[i];
+          if (iio_event_class(ctr) != "bandwidth")
+            continue;
+          auto event = complete.emplace(ctr.h_event_name, true).first;
+          if (!ctr.sampled || ctr.last_sampled == pcm_iio_stack_observed[i])
+            event->second = false;
+        }
+        for (const auto &event : complete)
+        {
+          if (!event.second)
+            continue;
+          for (size_t i = 0; i < evt_ctx.ctrs.size(); ++i)
+          {
+            if (evt_ctx.ctrs[i].h_event_name == event.first)
+              pcm_iio_stack_observed[i] = evt_ctx.ctrs[i].last_sampled;
+          }
+          for (const auto &socket : iios)
+          {
+            for (const auto &stack : socket.stacks)
+            {
+              double total = 0.0;
+              for (const auto &ctr : evt_ctx.ctrs)
+              {
+                if (ctr.h_event_name == event.first && iio_series_active(socket.socket_id, stack.iio_unit_id, ctr))
+                  total += iio_series_rate(socket.socket_id, stack.iio_unit_id, ctr);
+              }
+              pcm_iio_stack_hist[std::make_pair(std::make_pair(socket.socket_id, stack.iio_unit_id), event.first)]->Observe(total);
             }
           }
         }
+        pcm_iio_snapshot->publish();
+        exposer.publish();
         return true; });
 
   file_stream.close();
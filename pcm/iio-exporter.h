@@ -22,6 +22,11 @@
 #include <numeric>
 #include <algorithm>
 #include <set>
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <cmath>
 
 #ifdef _MSC_VER
 #include "freegetopt/getopt.h"
@@ -29,6 +34,19 @@
 
 #include "lspci.h"
 #include "utils.h"
+#include "exporter-affinity.h"
+#include "exporter-schedule.h"
+#include "pci-sysfs-index.h"
+#include "exposition-filter.h"
+#include "parallel-tasks.h"
+#include "pci-ids.h"
+#include "iio-topology-cache.h"
+#include "counter-accumulator.h"
+#include "sampling-estimate.h"
+#include "window-summary.h"
+#include "bandwidth-histogram.h"
+#include "iio-event-tables.h"
+#include "exposition-server.h"
 using namespace std;
 using namespace pcm;
 
@@ -445,10 +463,117 @@ static const std::string srf_iio_stack_names[] = {
 struct iio_counter : public counter
 {
     std::vector<result_content> data;
+    /* multiplexing state */
+    bool sampled = false;
+    std::chrono::steady_clock::time_point last_sampled;
+    int64_t sampled_ms = 0; // wall clock time the last sample was measured, ms since the epoch
+    double activity = 0.0;  // EWMA of the rate summed over all stacks
+    bool idle = false;      // no stack had traffic in the last sample
+    uint32_t idle_cycles = 0;
 };
 
 result_content results;
 
+// Per-series (socket, stack, counter) estimate quality.
+typedef SamplingEstimate iio_series_stats;
+
+typedef std::vector<std::vector<std::map<std::pair<h_id, v_id>, iio_series_stats>>> series_stats_content;
+series_stats_content series_stats;
+
+// Per-series exact event totals; results holds the rates derived from them.
+typedef std::vector<std::vector<std::map<std::pair<h_id, v_id>, CounterAccumulator>>> series_totals_content;
+series_totals_content series_totals;
+
+// Bytes (or events) per second of the last sample of a series.
+double iio_series_rate(uint32_t socket, uint32_t stack, const struct iio_counter &ctr)
+{
+    const auto &totals = series_totals[socket][stack];
+    const auto acc = totals.find(std::pair<h_id, v_id>(ctr.h_id, ctr.v_id));
+    if (acc == totals.end())
+        return 0.0;
+    return acc->second.rate(ctr.multiplier, ctr.divider);
+}
+
+// Adaptive multiplexing (-adaptive): slices are weighted by recent traffic.
+bool adaptiveMultiplexing = false;
+uint32_t minRevisitCycles = 5; // idle counters are sampled at least every N cycles
+double idleShare = 0.05;       // slice weight of an idle counter relative to the busiest one
+
+// Topology pruning: parts without devices and stacks without parts are neither sampled nor exported (-all disables it).
+bool pruneTopology = true;
+// Part ids with devices behind them, by (socket, IIO unit).
+std::map<std::pair<uint32_t, uint32_t>, std::set<int>> iio_active_parts;
+
+// Returns N for a per-part counter (vname "PartN"), -1 for a per-stack one.
+int iio_counter_part(const struct iio_counter &ctr)
+{
+    if (ctr.v_event_name.compare(0, 4, "Part") != 0)
+        return -1;
+    return atoi(ctr.v_event_name.c_str() + 4);
+}
+
+// Whether the (socket, stack, counter) series carries data after pruning.
+bool iio_series_active(uint32_t socket_id, uint32_t iio_unit_id, const struct iio_counter &ctr)
+{
+    const int part = iio_counter_part(ctr);
+    if (!pruneTopology || part < 0)
+        return true;
+    const auto parts = iio_active_parts.find(std::make_pair(socket_id, iio_unit_id));
+    return parts != iio_active_parts.end() && parts->second.count(part) != 0;
+}
+
+/*
+ * Drops parts with no device attached and stacks that are left without parts.
+ * A device may feed several counter parts (parts_no, e.g. DSA/IAX on SPR), so the
+ * active part set is the union of the children's parts_no, or the part_id itself.
+ */
+void prune_iio_topology(std::vector<struct iio_stacks_on_socket> &iios)
+{
+    iio_active_parts.clear();
+    for (auto &socket : iios)
+    {
+        for (auto &stack : socket.stacks)
+        {
+            auto &active = iio_active_parts[std::make_pair(socket.socket_id, stack.iio_unit_id)];
+            for (const auto &part : stack.parts)
+            {
+                for (const auto &dev : part.child_pci_devs)
+                {
+                    if (dev.parts_no.empty())
+                        active.insert(part.part_id);
+                    active.insert(dev.parts_no.begin(), dev.parts_no.end());
+                }
+            }
+        }
+        if (!pruneTopology)
+            continue;
+        for (auto &stack : socket.stacks)
+        {
+            stack.parts.erase(std::remove_if(stack.parts.begin(), stack.parts.end(), [](const struct iio_bifurcated_part &part)
+                                             { return part.child_pci_devs.empty(); }),
+                              stack.parts.end());
+        }
+        socket.stacks.erase(std::remove_if(socket.stacks.begin(), socket.stacks.end(), [](const struct iio_stack &stack)
+                                           { return stack.parts.empty(); }),
+                            socket.stacks.end());
+    }
+}
+
+// Drops the per-part counters whose part has no device on any stack.
+void prune_iio_counters(vector<struct iio_counter> &ctrs)
+{
+    if (!pruneTopology)
+        return;
+    std::set<int> used_parts;
+    for (const auto &parts : iio_active_parts)
+        used_parts.insert(parts.second.begin(), parts.second.end());
+    ctrs.erase(std::remove_if(ctrs.begin(), ctrs.end(), [&](const struct iio_counter &ctr)
+                              {
+                                  const int part = iio_counter_part(ctr);
+                                  return part >= 0 && used_parts.count(part) == 0; }),
+               ctrs.end());
+}
+
 typedef struct
 {
     PCM *m;
@@ -476,7 +601,7 @@ vector<string> combine_stack_name_and_counter_names(string stack_name, const map
     return v;
 }
 
-string build_pci_header(const PCIDB &pciDB, uint32_t column_width, const struct pci &p, int part = -1, uint32_t level = 0)
+string build_pci_header(const PciIdDatabase &pciDB, uint32_t column_width, const struct pci &p, int part = -1, uint32_t level = 0)
 {
     string s = "|";
     char bdf_buf[32];
@@ -487,9 +612,11 @@ string build_pci_header(const PCIDB &pciDB, uint32_t column_width, const struct
     snprintf(bdf_buf, sizeof(bdf_buf), "%04X:%02X:%02X.%1d", p.bdf.domainno, p.bdf.busno, p.bdf.devno, p.bdf.funcno);
     snprintf(speed_buf, sizeof(speed_buf), "Gen%1d x%-2d", p.link_speed, p.link_width);
     snprintf(vid_did_buf, sizeof(vid_did_buf), "%04X:%04X", p.vendor_id, p.device_id);
+    const string vendor_name = pciDB.vendorName(p.vendor_id);
+    const string device_name = pciDB.deviceName(p.vendor_id, p.device_id);
     snprintf(device_name_buf, sizeof(device_name_buf), "%s %s",
-             (pciDB.first.count(p.vendor_id) > 0) ? pciDB.first.at(p.vendor_id).c_str() : "unknown vendor",
-             (pciDB.second.count(p.vendor_id) > 0 && pciDB.second.at(p.vendor_id).count(p.device_id) > 0) ? pciDB.second.at(p.vendor_id).at(p.device_id).c_str() : "unknown device");
+             vendor_name.empty() ? "unknown vendor" : vendor_name.c_str(),
+             device_name.empty() ? "unknown device" : device_name.c_str());
     s += bdf_buf;
     s += '|';
     s += speed_buf;
@@ -522,7 +649,7 @@ string build_pci_header(const PCIDB &pciDB, uint32_t column_width, const struct
     return s;
 }
 
-void build_pci_tree(vector<string> &buffer, const PCIDB &pciDB, uint32_t column_width, const struct pci &p, int part, uint32_t level = 0)
+void build_pci_tree(vector<string> &buffer, const PciIdDatabase &pciDB, uint32_t column_width, const struct pci &p, int part, uint32_t level = 0)
 {
     string row;
     for (const auto &child : p.child_pci_devs)
@@ -534,7 +661,7 @@ void build_pci_tree(vector<string> &buffer, const PCIDB &pciDB, uint32_t column_
     }
 }
 
-vector<string> build_display(vector<struct iio_stacks_on_socket> &iios, vector<struct iio_counter> &ctrs, const PCIDB &pciDB,
+vector<string> build_display(vector<struct iio_stacks_on_socket> &iios, vector<struct iio_counter> &ctrs, const PciIdDatabase &pciDB,
                              const map<string, std::pair<h_id, std::map<string, v_id>>> &nameMap)
 {
     vector<string> buffer;
@@ -714,6 +841,10 @@ private:
 
 protected:
     void probeDeviceRange(std::vector<struct pci> &child_pci_devs, int domain, int secondary, int subordinate);
+    bool scanDomains(std::map<int, std::map<int, struct bdf>> &root_buses,
+                     const std::function<bool(uint32_t, std::map<int, std::map<int, struct bdf>> &, std::ostream &)> &scan);
+    bool probeStacks(const std::map<int, std::map<int, struct bdf>> &root_buses, std::vector<struct iio_stacks_on_socket> &iios,
+                     const std::function<bool(int, const struct bdf &, struct iio_stacks_on_socket &)> &probe);
 
 public:
     IPlatformMapping(int cpu_model, uint32_t sockets_count) : m_sockets(sockets_count), m_model(cpu_model) {}
@@ -806,7 +937,7 @@ bool PurleyPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_on_soc
                 {
                     pci->exist = false;
                 }
-                else if (probe_pci(pci))
+                else if (probe_present_pci(pci))
                 {
                     /* FIXME: for 0:0.0, we may need to scan from secondary switch down; lgtm [cpp/fixme-comment] */
                     for (uint8_t bus = pci->secondary_bus_number; bus <= pci->subordinate_bus_number; bus++)
@@ -819,7 +950,7 @@ bool PurleyPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_on_soc
                                 child_pci_dev.bdf.busno = bus;
                                 child_pci_dev.bdf.devno = device;
                                 child_pci_dev.bdf.funcno = function;
-                                if (probe_pci(&child_pci_dev))
+                                if (probe_present_pci(&child_pci_dev))
                                 {
                                     part.child_pci_devs.push_back(child_pci_dev);
                                 }
@@ -962,7 +1093,7 @@ bool WhitleyPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_on_so
                     bdf->busno = root_bus;
                     bdf->devno = 0x00;
                     bdf->funcno = 0x00;
-                    if (probe_pci(pci))
+                    if (probe_present_pci(pci))
                     {
                         // Probe child devices only under PCH part.
                         for (uint8_t bus = pci->secondary_bus_number; bus <= pci->subordinate_bus_number; bus++)
@@ -975,7 +1106,7 @@ bool WhitleyPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_on_so
                                     child_pci_dev.bdf.busno = bus;
                                     child_pci_dev.bdf.devno = device;
                                     child_pci_dev.bdf.funcno = function;
-                                    if (probe_pci(&child_pci_dev))
+                                    if (probe_present_pci(&child_pci_dev))
                                     {
                                         pch_part.child_pci_devs.push_back(child_pci_dev);
                                     }
@@ -993,7 +1124,7 @@ bool WhitleyPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_on_so
                 bdf->busno = root_bus;
                 bdf->devno = 0x01;
                 bdf->funcno = 0x00;
-                if (probe_pci(pci))
+                if (probe_present_pci(pci))
                     stack.parts.push_back(part);
 
                 iio_on_socket.stacks.push_back(stack);
@@ -1008,7 +1139,7 @@ bool WhitleyPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_on_so
                 pci.bdf.busno = root_bus;
                 pci.bdf.devno = slot;
                 pci.bdf.funcno = 0x00;
-                if (!probe_pci(&pci))
+                if (!probe_present_pci(&pci))
                 {
                     continue;
                 }
@@ -1026,7 +1157,7 @@ bool WhitleyPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_on_so
                             child_pci_dev.bdf.busno = bus;
                             child_pci_dev.bdf.devno = device;
                             child_pci_dev.bdf.funcno = function;
-                            if (probe_pci(&child_pci_dev))
+                            if (probe_present_pci(&child_pci_dev))
                             {
                                 part.child_pci_devs.push_back(child_pci_dev);
                             }
@@ -1084,7 +1215,7 @@ bool JacobsvillePlatformMapping::JacobsvilleAccelerators(const std::pair<uint8_t
                 pci_dev.bdf.busno = (uint8_t)bus;
                 pci_dev.bdf.devno = device;
                 pci_dev.bdf.funcno = function;
-                if (probe_pci(&pci_dev))
+                if (probe_present_pci(&pci_dev))
                 {
                     if (expected_dev_id == pci_dev.device_id)
                     {
@@ -1136,7 +1267,7 @@ bool JacobsvillePlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_o
             pci_dev.bdf.busno = root_bus;
             pci_dev.bdf.devno = 0x01;
             pci_dev.bdf.funcno = 0x00;
-            if (probe_pci(&pci_dev))
+            if (probe_present_pci(&pci_dev))
             {
                 part.root_pci_dev = pci_dev;
                 stack.parts.push_back(part);
@@ -1146,7 +1277,7 @@ bool JacobsvillePlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_o
             pci_dev.bdf.busno = root_bus;
             pci_dev.bdf.devno = 0x00;
             pci_dev.bdf.funcno = 0x00;
-            if (probe_pci(&pci_dev))
+            if (probe_present_pci(&pci_dev))
             {
                 for (uint8_t bus = pci_dev.secondary_bus_number; bus <= pci_dev.subordinate_bus_number; bus++)
                 {
@@ -1158,7 +1289,7 @@ bool JacobsvillePlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_o
                             child_pci_dev.bdf.busno = bus;
                             child_pci_dev.bdf.devno = device;
                             child_pci_dev.bdf.funcno = function;
-                            if (probe_pci(&child_pci_dev))
+                            if (probe_present_pci(&child_pci_dev))
                             {
                                 part.child_pci_devs.push_back(child_pci_dev);
                             }
@@ -1182,7 +1313,7 @@ bool JacobsvillePlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_o
                 pci_dev.bdf.busno = root_bus;
                 pci_dev.bdf.devno = slot;
                 pci_dev.bdf.funcno = 0x00;
-                if (!probe_pci(&pci_dev))
+                if (!probe_present_pci(&pci_dev))
                 {
                     continue;
                 }
@@ -1205,7 +1336,7 @@ bool JacobsvillePlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_o
                             child_pci_dev.bdf.busno = bus;
                             child_pci_dev.bdf.devno = device;
                             child_pci_dev.bdf.funcno = function;
-                            if (probe_pci(&child_pci_dev))
+                            if (probe_present_pci(&child_pci_dev))
                             {
                                 part.child_pci_devs.push_back(child_pci_dev);
                             }
@@ -1239,6 +1370,7 @@ class EagleStreamPlatformMapping : public IPlatformMapping
 {
 private:
     bool getRootBuses(std::map<int, std::map<int, struct bdf>> &root_buses);
+    bool getDomainRootBuses(uint32_t domain, std::map<int, std::map<int, struct bdf>> &root_buses, std::ostream &log);
     bool stackProbe(int unit, const struct bdf &address, struct iio_stacks_on_socket &iio_on_socket);
     bool eagleStreamDmiStackProbe(int unit, const struct bdf &address, struct iio_stacks_on_socket &iio_on_socket);
     bool eagleStreamPciStackProbe(int unit, const struct bdf &address, struct iio_stacks_on_socket &iio_on_socket);
@@ -1301,60 +1433,60 @@ bool EagleStreamPlatformMapping::setChopValue()
 
 bool EagleStreamPlatformMapping::getRootBuses(std::map<int, std::map<int, struct bdf>> &root_buses)
 {
-    bool mapped = true;
-    for (uint32_t domain = 0; mapped; domain++)
+    return scanDomains(root_buses, [this](uint32_t domain, std::map<int, std::map<int, struct bdf>> &domain_root_buses, std::ostream &log)
+                       { return getDomainRootBuses(domain, domain_root_buses, log); });
+}
+
+bool EagleStreamPlatformMapping::getDomainRootBuses(uint32_t domain, std::map<int, std::map<int, struct bdf>> &root_buses, std::ostream &log)
+{
+    for (uint16_t b = 0; b < 256; b++)
     {
-        mapped = false;
-        for (uint16_t b = 0; b < 256; b++)
+        for (uint8_t d = 0; d < 32; d++)
         {
-            for (uint8_t d = 0; d < 32; d++)
+            for (uint8_t f = 0; f < 8; f++)
             {
-                for (uint8_t f = 0; f < 8; f++)
+                struct pci pci_dev(domain, b, d, f);
+                if (!probe_pci(&pci_dev))
                 {
-                    struct pci pci_dev(domain, b, d, f);
-                    if (!probe_pci(&pci_dev))
-                    {
-                        break;
-                    }
-                    if (!((pci_dev.vendor_id == PCM_INTEL_PCI_VENDOR_ID) && (pci_dev.device_id == SPR_MSM_DEV_ID)))
-                    {
-                        continue;
-                    }
+                    break;
+                }
+                if (!((pci_dev.vendor_id == PCM_INTEL_PCI_VENDOR_ID) && (pci_dev.device_id == SPR_MSM_DEV_ID)))
+                {
+                    continue;
+                }
+
+                std::uint32_t cpuBusValid;
+                std::vector<std::uint32_t> cpuBusNo;
+                int package_id;
 
-                    std::uint32_t cpuBusValid;
-                    std::vector<std::uint32_t> cpuBusNo;
-                    int package_id;
+                if (get_cpu_bus(domain, b, d, f, cpuBusValid, cpuBusNo, package_id) == false)
+                {
+                    return false;
+                }
 
-                    if (get_cpu_bus(domain, b, d, f, cpuBusValid, cpuBusNo, package_id) == false)
+                const auto &sad_to_pmu_id_mapping = es_sad_to_pmu_id_mapping.at(m_es_type);
+                for (int cpuBusId = 0; cpuBusId < SPR_MSM_CPUBUSNO_MAX; ++cpuBusId)
+                {
+                    if (!((cpuBusValid >> cpuBusId) & 0x1))
                     {
-                        return false;
+                        log << "CPU bus " << cpuBusId << " is disabled on package " << package_id << endl;
+                        continue;
                     }
-
-                    const auto &sad_to_pmu_id_mapping = es_sad_to_pmu_id_mapping.at(m_es_type);
-                    for (int cpuBusId = 0; cpuBusId < SPR_MSM_CPUBUSNO_MAX; ++cpuBusId)
+                    if (sad_to_pmu_id_mapping.find(cpuBusId) == sad_to_pmu_id_mapping.end())
                     {
-                        if (!((cpuBusValid >> cpuBusId) & 0x1))
-                        {
-                            cout << "CPU bus " << cpuBusId << " is disabled on package " << package_id << endl;
-                            continue;
-                        }
-                        if (sad_to_pmu_id_mapping.find(cpuBusId) == sad_to_pmu_id_mapping.end())
-                        {
-                            cerr << "Cannot map CPU bus " << cpuBusId << " to IO PMU ID" << endl;
-                            continue;
-                        }
-                        int pmuId = sad_to_pmu_id_mapping.at(cpuBusId);
-                        int rootBus = (cpuBusNo[(int)(cpuBusId / 4)] >> ((cpuBusId % 4) * 8)) & 0xff;
-                        root_buses[package_id][pmuId] = bdf(domain, rootBus, 0, 0);
-                        cout << "Mapped CPU bus #" << cpuBusId << " (domain " << domain << " bus " << std::hex << rootBus << std::dec << ") to IO PMU #"
-                             << pmuId << " package " << package_id << endl;
-                        mapped = true;
+                        log << "Cannot map CPU bus " << cpuBusId << " to IO PMU ID" << endl;
+                        continue;
                     }
+                    int pmuId = sad_to_pmu_id_mapping.at(cpuBusId);
+                    int rootBus = (cpuBusNo[(int)(cpuBusId / 4)] >> ((cpuBusId % 4) * 8)) & 0xff;
+                    root_buses[package_id][pmuId] = bdf(domain, rootBus, 0, 0);
+                    log << "Mapped CPU bus #" << cpuBusId << " (domain " << domain << " bus " << std::hex << rootBus << std::dec << ") to IO PMU #"
+                        << pmuId << " package " << package_id << endl;
                 }
             }
         }
     }
-    return !root_buses.empty();
+    return true;
 }
 
 bool EagleStreamPlatformMapping::eagleStreamDmiStackProbe(int unit, const struct bdf &address, struct iio_stacks_on_socket &iio_on_socket)
@@ -1369,7 +1501,7 @@ bool EagleStreamPlatformMapping::eagleStreamDmiStackProbe(int unit, const struct
     auto dmi_part_id = SPR_DMI_PART_ID;
     pch_part.part_id = dmi_part_id;
     pci->bdf = address;
-    if (!probe_pci(pci))
+    if (!probe_present_pci(pci))
     {
         cerr << "Failed to probe DMI Stack: address: " << std::setw(4) << std::setfill('0') << std::hex << address.domainno << std::setw(2) << std::setfill('0') << ":" << address.busno << ":" << address.devno << "." << address.funcno << std::dec << endl;
         return false;
@@ -1401,7 +1533,7 @@ bool EagleStreamPlatformMapping::eagleStreamPciStackProbe(int unit, const struct
         // Check if port is enabled
         struct pci root_pci_dev;
         root_pci_dev.bdf = bdf(address.domainno, address.busno, slot, 0x0);
-        if (probe_pci(&root_pci_dev))
+        if (probe_present_pci(&root_pci_dev))
         {
             struct iio_bifurcated_part part;
             // Bifurcated Root Ports to channel mapping on SPR
@@ -1414,7 +1546,7 @@ bool EagleStreamPlatformMapping::eagleStreamPciStackProbe(int unit, const struct
                     for (uint8_t f = 0; f < 8; ++f)
                     {
                         struct pci child_pci_dev(address.domainno, b, d, f);
-                        if (probe_pci(&child_pci_dev))
+                        if (probe_present_pci(&child_pci_dev))
                         {
                             child_pci_dev.parts_no.push_back(part.part_id);
                             part.child_pci_devs.push_back(child_pci_dev);
@@ -1449,7 +1581,7 @@ bool EagleStreamPlatformMapping::eagleStreamAcceleratorStackProbe(int unit, cons
                 struct iio_bifurcated_part part;
                 struct pci pci_dev(address.domainno, b, d, f);
 
-                if (probe_pci(&pci_dev))
+                if (probe_present_pci(&pci_dev))
                 {
                     if (pci_dev.vendor_id == PCM_INTEL_PCI_VENDOR_ID)
                     {
@@ -1539,27 +1671,31 @@ bool EagleStreamPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_o
         return false;
     }
 
-    for (auto iter = root_buses.cbegin(); iter != root_buses.cend(); ++iter)
+    return probeStacks(root_buses, iios, [this](int unit, const struct bdf &address, struct iio_stacks_on_socket &iio_on_socket)
+                       { return stackProbe(unit, address, iio_on_socket); });
+}
+
+void IPlatformMapping::probeDeviceRange(std::vector<struct pci> &pci_devs, int domain, int secondary, int subordinate)
+{
+    if (usePciSysfsIndex())
     {
-        auto rbs_on_socket = iter->second;
-        struct iio_stacks_on_socket iio_on_socket;
-        iio_on_socket.socket_id = iter->first;
-        for (auto rb = rbs_on_socket.cbegin(); rb != rbs_on_socket.cend(); ++rb)
+        // Same traversal, restricted to the functions the kernel enumerated.
+        for (const auto &address : pciSysfsIndex().functionsInRange(domain, secondary, subordinate))
         {
-            if (!stackProbe(rb->first, rb->second, iio_on_socket))
+            struct pci child_dev;
+            child_dev.bdf = address;
+            if (pcm::probe_pci(&child_dev))
             {
-                return false;
+                if (secondary < child_dev.secondary_bus_number && subordinate < child_dev.subordinate_bus_number)
+                {
+                    probeDeviceRange(child_dev.child_pci_devs, domain, child_dev.secondary_bus_number, child_dev.subordinate_bus_number);
+                }
+                pci_devs.push_back(child_dev);
             }
         }
-        std::sort(iio_on_socket.stacks.begin(), iio_on_socket.stacks.end());
-        iios.push_back(iio_on_socket);
+        return;
     }
 
-    return true;
-}
-
-void IPlatformMapping::probeDeviceRange(std::vector<struct pci> &pci_devs, int domain, int secondary, int subordinate)
-{
     for (uint8_t bus = secondary; int(bus) <= subordinate; bus++)
     {
         for (uint8_t device = 0; device < 32; device++)
@@ -1571,7 +1707,7 @@ void IPlatformMapping::probeDeviceRange(std::vector<struct pci> &pci_devs, int d
                 child_dev.bdf.busno = bus;
                 child_dev.bdf.devno = device;
                 child_dev.bdf.funcno = function;
-                if (probe_pci(&child_dev))
+                if (probe_present_pci(&child_dev))
                 {
                     if (secondary < child_dev.secondary_bus_number && subordinate < child_dev.subordinate_bus_number)
                     {
@@ -1584,6 +1720,74 @@ void IPlatformMapping::probeDeviceRange(std::vector<struct pci> &pci_devs, int d
     }
 }
 
+/*
+ * Scans PCI domains for root buses until the first domain without any, like the
+ * sequential loop did. Domain 0 is scanned in the calling thread (it also
+ * initializes the config space access), the following ones in batches of
+ * discoveryThreads. Logs and results are merged in domain order.
+ */
+bool IPlatformMapping::scanDomains(std::map<int, std::map<int, struct bdf>> &root_buses,
+                                   const std::function<bool(uint32_t, std::map<int, std::map<int, struct bdf>> &, std::ostream &)> &scan)
+{
+    uint32_t first = 0;
+    for (size_t batch = 1;; first += (uint32_t)batch, batch = discoveryThreads)
+    {
+        std::vector<std::map<int, std::map<int, struct bdf>>> found(batch);
+        std::vector<std::ostringstream> logs(batch);
+        std::vector<char> ok(batch, 0);
+        runParallel(batch, discoveryThreads, [&](size_t i)
+                    { ok[i] = scan(first + (uint32_t)i, found[i], logs[i]); });
+        for (size_t i = 0; i < batch; ++i)
+        {
+            cout << logs[i].str();
+            if (!ok[i])
+                return false;
+            if (found[i].empty())
+                return !root_buses.empty();
+            for (const auto &socket : found[i])
+                for (const auto &rb : socket.second)
+                    root_buses[socket.first][rb.first] = rb.second;
+        }
+    }
+}
+
+// Probes every root bus as an independent task and merges the stacks per socket, sorted as before.
+bool IPlatformMapping::probeStacks(const std::map<int, std::map<int, struct bdf>> &root_buses, std::vector<struct iio_stacks_on_socket> &iios,
+                                   const std::function<bool(int, const struct bdf &, struct iio_stacks_on_socket &)> &probe)
+{
+    struct stack_task
+    {
+        int socket;
+        int unit;
+        struct bdf address;
+    };
+    std::vector<stack_task> tasks;
+    for (const auto &socket : root_buses)
+        for (const auto &rb : socket.second)
+            tasks.push_back(stack_task{socket.first, rb.first, rb.second});
+
+    std::vector<struct iio_stacks_on_socket> probed(tasks.size());
+    std::vector<char> ok(tasks.size(), 0);
+    runParallel(tasks.size(), discoveryThreads, [&](size_t i)
+                {
+                    probed[i].socket_id = tasks[i].socket;
+                    ok[i] = probe(tasks[i].unit, tasks[i].address, probed[i]); });
+    if (std::find(ok.begin(), ok.end(), 0) != ok.end())
+        return false;
+
+    size_t task = 0;
+    for (const auto &socket : root_buses)
+    {
+        struct iio_stacks_on_socket iio_on_socket;
+        iio_on_socket.socket_id = socket.first;
+        for (size_t n = 0; n < socket.second.size(); ++n, ++task)
+            iio_on_socket.stacks.insert(iio_on_socket.stacks.end(), probed[task].stacks.begin(), probed[task].stacks.end());
+        std::sort(iio_on_socket.stacks.begin(), iio_on_socket.stacks.end());
+        iios.push_back(iio_on_socket);
+    }
+    return true;
+}
+
 class BirchStreamPlatform : public IPlatformMapping
 {
 private:
@@ -1597,6 +1801,7 @@ private:
 
     bool stackProbe(int unit, const struct bdf &address, struct iio_stacks_on_socket &iio_on_socket);
     bool getRootBuses(std::map<int, std::map<int, struct bdf>> &root_buses);
+    bool getDomainRootBuses(uint32_t domain, std::map<int, std::map<int, struct bdf>> &root_buses, std::ostream &log);
 
 public:
     BirchStreamPlatform(int cpu_model, uint32_t sockets_count) : IPlatformMapping(cpu_model, sockets_count) {}
@@ -1618,7 +1823,7 @@ bool BirchStreamPlatform::birchStreamPciStackProbe(int unit, const struct bdf &a
     {
         struct pci root_pci_dev;
         root_pci_dev.bdf = bdf(address.domainno, address.busno, slot, 0x0);
-        if (probe_pci(&root_pci_dev))
+        if (probe_present_pci(&root_pci_dev))
         {
             struct iio_bifurcated_part part;
             part.part_id = slot - 2;
@@ -1630,7 +1835,7 @@ bool BirchStreamPlatform::birchStreamPciStackProbe(int unit, const struct bdf &a
                     for (uint8_t f = 0; f < 8; ++f)
                     {
                         struct pci child_pci_dev(address.domainno, b, d, f);
-                        if (probe_pci(&child_pci_dev))
+                        if (probe_present_pci(&child_pci_dev))
                         {
                             child_pci_dev.parts_no.push_back(part.part_id);
                             part.child_pci_devs.push_back(child_pci_dev);
@@ -1662,7 +1867,7 @@ bool BirchStreamPlatform::birchStreamAcceleratorStackProbe(int unit, const struc
     auto process_pci_dev = [](int domainno, int busno, int devno, int part_number, iio_bifurcated_part &part)
     {
         struct pci pci_dev(domainno, busno, devno, 0);
-        if (probe_pci(&pci_dev) && pci_dev.isIntelDevice())
+        if (probe_present_pci(&pci_dev) && pci_dev.isIntelDevice())
         {
             part.part_id = part_number;
             pci_dev.parts_no.push_back(part_number);
@@ -1760,53 +1965,53 @@ bool BirchStreamPlatform::stackProbe(int unit, const struct bdf &address, struct
 
 bool BirchStreamPlatform::getRootBuses(std::map<int, std::map<int, struct bdf>> &root_buses)
 {
-    bool mapped = true;
-    for (uint32_t domain = 0; mapped; domain++)
+    return scanDomains(root_buses, [this](uint32_t domain, std::map<int, std::map<int, struct bdf>> &domain_root_buses, std::ostream &log)
+                       { return getDomainRootBuses(domain, domain_root_buses, log); });
+}
+
+bool BirchStreamPlatform::getDomainRootBuses(uint32_t domain, std::map<int, std::map<int, struct bdf>> &root_buses, std::ostream &log)
+{
+    for (uint16_t b = 0; b < 256; b++)
     {
-        mapped = false;
-        for (uint16_t b = 0; b < 256; b++)
+        for (uint8_t d = 0; d < 32; d++)
         {
-            for (uint8_t d = 0; d < 32; d++)
+            for (uint8_t f = 0; f < 8; f++)
             {
-                for (uint8_t f = 0; f < 8; f++)
+                struct pci pci_dev(domain, b, d, f);
+                if (!probe_pci(&pci_dev))
                 {
-                    struct pci pci_dev(domain, b, d, f);
-                    if (!probe_pci(&pci_dev))
-                    {
-                        break;
-                    }
-                    if (!((pci_dev.vendor_id == PCM_INTEL_PCI_VENDOR_ID) && (pci_dev.device_id == SPR_MSM_DEV_ID)))
-                    {
-                        continue;
-                    }
+                    break;
+                }
+                if (!((pci_dev.vendor_id == PCM_INTEL_PCI_VENDOR_ID) && (pci_dev.device_id == SPR_MSM_DEV_ID)))
+                {
+                    continue;
+                }
 
-                    std::uint32_t cpuBusValid;
-                    std::vector<std::uint32_t> cpuBusNo;
-                    int package_id;
+                std::uint32_t cpuBusValid;
+                std::vector<std::uint32_t> cpuBusNo;
+                int package_id;
 
-                    if (get_cpu_bus(domain, b, d, f, cpuBusValid, cpuBusNo, package_id) == false)
-                    {
-                        return false;
-                    }
+                if (get_cpu_bus(domain, b, d, f, cpuBusValid, cpuBusNo, package_id) == false)
+                {
+                    return false;
+                }
 
-                    for (int cpuBusId = 0; cpuBusId < SPR_MSM_CPUBUSNO_MAX; ++cpuBusId)
+                for (int cpuBusId = 0; cpuBusId < SPR_MSM_CPUBUSNO_MAX; ++cpuBusId)
+                {
+                    if (!((cpuBusValid >> cpuBusId) & 0x1))
                     {
-                        if (!((cpuBusValid >> cpuBusId) & 0x1))
-                        {
-                            cout << "CPU bus " << cpuBusId << " is disabled on package " << package_id << endl;
-                            continue;
-                        }
-                        int rootBus = (cpuBusNo[(int)(cpuBusId / 4)] >> ((cpuBusId % 4) * 8)) & 0xff;
-                        root_buses[package_id][cpuBusId] = bdf(domain, rootBus, 0, 0);
-                        cout << "Mapped CPU bus #" << cpuBusId << " (domain " << domain << " bus " << std::hex << rootBus << std::dec << ")"
-                             << " package " << package_id << endl;
-                        mapped = true;
+                        log << "CPU bus " << cpuBusId << " is disabled on package " << package_id << endl;
+                        continue;
                     }
+                    int rootBus = (cpuBusNo[(int)(cpuBusId / 4)] >> ((cpuBusId % 4) * 8)) & 0xff;
+                    root_buses[package_id][cpuBusId] = bdf(domain, rootBus, 0, 0);
+                    log << "Mapped CPU bus #" << cpuBusId << " (domain " << domain << " bus " << std::hex << rootBus << std::dec << ")"
+                        << " package " << package_id << endl;
                 }
             }
         }
     }
-    return !root_buses.empty();
+    return true;
 }
 
 bool BirchStreamPlatform::pciTreeDiscover(std::vector<struct iio_stacks_on_socket> &iios)
@@ -1817,23 +2022,8 @@ bool BirchStreamPlatform::pciTreeDiscover(std::vector<struct iio_stacks_on_socke
         return false;
     }
 
-    for (auto iter = root_buses.cbegin(); iter != root_buses.cend(); ++iter)
-    {
-        auto rbs_on_socket = iter->second;
-        struct iio_stacks_on_socket iio_on_socket;
-        iio_on_socket.socket_id = iter->first;
-        for (auto rb = rbs_on_socket.cbegin(); rb != rbs_on_socket.cend(); ++rb)
-        {
-            if (!stackProbe(rb->first, rb->second, iio_on_socket))
-            {
-                return false;
-            }
-        }
-        std::sort(iio_on_socket.stacks.begin(), iio_on_socket.stacks.end());
-        iios.push_back(iio_on_socket);
-    }
-
-    return true;
+    return probeStacks(root_buses, iios, [this](int unit, const struct bdf &address, struct iio_stacks_on_socket &iio_on_socket)
+                       { return stackProbe(unit, address, iio_on_socket); });
 }
 
 std::unique_ptr<IPlatformMapping> IPlatformMapping::getPlatformMapping(int cpu_family_model, uint32_t sockets_count)
@@ -1960,26 +2150,53 @@ result_content get_IIO_Samples(PCM *m, const std::vector<struct iio_stacks_on_so
     after = new IIOCounterState[iios.size() * stacks_count];
 
     m->programIIOCounters(rawEvents);
-    for (auto socket = iios.cbegin(); socket != iios.cend(); ++socket)
+    std::chrono::steady_clock::time_point before_time, after_time;
     {
-        for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack)
+        SnapshotPriorityGuard snapshotPriority;
+        for (auto socket = iios.cbegin(); socket != iios.cend(); ++socket)
         {
-            auto iio_unit_id = stack->iio_unit_id;
-            uint32_t idx = (uint32_t)stacks_count * socket->socket_id + iio_unit_id;
-            before[idx] = m->getIIOCounterState(socket->socket_id, iio_unit_id, ctr.idx);
+            for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack)
+            {
+                auto iio_unit_id = stack->iio_unit_id;
+                if (!iio_series_active(socket->socket_id, iio_unit_id, ctr))
+                    continue;
+                uint32_t idx = (uint32_t)stacks_count * socket->socket_id + iio_unit_id;
+                before[idx] = m->getIIOCounterState(socket->socket_id, iio_unit_id, ctr.idx);
+            }
         }
+        before_time = std::chrono::steady_clock::now();
     }
     MySleepMs(delay_ms);
+    {
+        SnapshotPriorityGuard snapshotPriority;
+        for (auto socket = iios.cbegin(); socket != iios.cend(); ++socket)
+        {
+            for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack)
+            {
+                auto iio_unit_id = stack->iio_unit_id;
+                if (!iio_series_active(socket->socket_id, iio_unit_id, ctr))
+                    continue;
+                uint32_t idx = (uint32_t)stacks_count * socket->socket_id + iio_unit_id;
+                after[idx] = m->getIIOCounterState(socket->socket_id, iio_unit_id, ctr.idx);
+            }
+        }
+        after_time = std::chrono::steady_clock::now();
+    }
+    const double elapsed = std::chrono::duration<double>(after_time - before_time).count();
+    const IIOCounterState zero;
     for (auto socket = iios.cbegin(); socket != iios.cend(); ++socket)
     {
         for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack)
         {
             auto iio_unit_id = stack->iio_unit_id;
+            if (!iio_series_active(socket->socket_id, iio_unit_id, ctr))
+                continue;
             uint32_t idx = (uint32_t)stacks_count * socket->socket_id + iio_unit_id;
-            after[idx] = m->getIIOCounterState(socket->socket_id, iio_unit_id, ctr.idx);
-            uint64_t raw_result = getNumberOfEvents(before[idx], after[idx]);
-            uint64_t trans_result = uint64_t(raw_result * ctr.multiplier / (double)ctr.divider * (1000 / (double)delay_ms));
-            results[socket->socket_id][iio_unit_id][std::pair<h_id, v_id>(ctr.h_id, ctr.v_id)] = trans_result;
+            const auto key = std::pair<h_id, v_id>(ctr.h_id, ctr.v_id);
+            auto acc = series_totals[socket->socket_id][iio_unit_id].emplace(key, CounterAccumulator(uncoreCounterWidth(UncorePmu::iio))).first;
+            // The counters are reprogrammed for every slice, so the accumulator only sees raw before/after pairs.
+            acc->second.add(getNumberOfEvents(zero, before[idx]), getNumberOfEvents(zero, after[idx]), elapsed);
+            results[socket->socket_id][iio_unit_id][key] = uint64_t(acc->second.rate(ctr.multiplier, ctr.divider));
         }
     }
     deleteAndNullifyArray(before);
@@ -1998,7 +2215,592 @@ void collect_data(PCM *m, const double delay, vector<struct iio_stacks_on_socket
     }
 }
 
-void print_PCIeMapping(const std::vector<struct iio_stacks_on_socket> &iios, const PCIDB &pciDB, std::ostream &stream)
+/*
+ * Per-part payload events (vname "PartN") are the bandwidth class, per-stack
+ * events (vname "Total": IOTLB, context cache, IOMMU) are the iommu class.
+ */
+std::string iio_event_class(const struct iio_counter &ctr)
+{
+    return ctr.v_event_name.compare(0, 4, "Part") == 0 ? "bandwidth" : "iommu";
+}
+
+// Counters sharing one hname, sampled with the same period.
+struct iio_event_group
+{
+    std::string name;
+    std::vector<size_t> ctrs; // indices into the counter vector
+};
+
+// Reports the -period= names that match neither an event class nor an hname of <ctrs>.
+bool check_period_names(const vector<struct iio_counter> &ctrs, const std::map<string, double> &periods)
+{
+    bool ok = true;
+    for (const auto &period : periods)
+    {
+        const bool known = std::any_of(ctrs.begin(), ctrs.end(), [&](const struct iio_counter &ctr)
+                                       { return ctr.h_event_name == period.first || iio_event_class(ctr) == period.first; });
+        if (!known)
+        {
+            cerr << "Unknown event class or name in -period: " << period.first << "\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Sampling period of <ctr>: looked up by hname, then by event class, defaults to <default_period>.
+double iio_counter_period(const struct iio_counter &ctr, const std::map<string, double> &periods, const double default_period)
+{
+    if (periods.count(ctr.h_event_name))
+        return periods.at(ctr.h_event_name);
+    if (periods.count(iio_event_class(ctr)))
+        return periods.at(iio_event_class(ctr));
+    return default_period;
+}
+
+/*
+ * Builds one event group per hname and registers it in the schedule; group i is
+ * schedule entry i. The period of a group is that of its counters
+ * (iio_counter_period).
+ */
+vector<struct iio_event_group> build_event_groups(const vector<struct iio_counter> &ctrs, const std::map<string, double> &periods,
+                                                  const double default_period, MultiRateSchedule &schedule)
+{
+    vector<struct iio_event_group> groups;
+    for (size_t i = 0; i < ctrs.size(); ++i)
+    {
+        auto group = std::find_if(groups.begin(), groups.end(), [&](const struct iio_event_group &g)
+                                  { return g.name == ctrs[i].h_event_name; });
+        if (group == groups.end())
+        {
+            schedule.add(ctrs[i].h_event_name, iio_counter_period(ctrs[i], periods, default_period));
+            groups.push_back(iio_event_group{ctrs[i].h_event_name, {}});
+            group = groups.end() - 1;
+        }
+        group->ctrs.push_back(i);
+    }
+    return groups;
+}
+
+/*
+ * Splits the cycle among the due counters. Without -adaptive every counter gets
+ * an equal slice. With it the slices are proportional to the recent traffic of
+ * the counter (summed over all stacks), idle counters get idleShare of the
+ * busiest one and are revisited only every minRevisitCycles cycles.
+ */
+std::vector<std::pair<size_t, uint32_t>> plan_slices(vector<struct iio_counter> &ctrs, const std::vector<size_t> &due_ctrs, const uint32_t cycle_ms)
+{
+    std::vector<std::pair<size_t, double>> weighted;
+    double max_activity = 0.0;
+    for (auto idx : due_ctrs)
+        max_activity = (std::max)(max_activity, ctrs[idx].activity);
+
+    double weight_sum = 0.0;
+    for (auto idx : due_ctrs)
+    {
+        auto &ctr = ctrs[idx];
+        double weight = 1.0;
+        if (adaptiveMultiplexing && ctr.sampled)
+        {
+            if (ctr.idle && ++ctr.idle_cycles < minRevisitCycles)
+                continue;
+            ctr.idle_cycles = 0;
+            if (max_activity > 0.0)
+                weight = (std::max)(idleShare, ctr.idle ? 0.0 : ctr.activity / max_activity);
+        }
+        weighted.push_back(std::make_pair(idx, weight));
+        weight_sum += weight;
+    }
+
+    std::vector<std::pair<size_t, uint32_t>> slices;
+    for (const auto &w : weighted)
+        slices.push_back(std::make_pair(w.first, (std::max)(1U, uint32_t(cycle_ms * w.second / weight_sum))));
+    return slices;
+}
+
+void update_series_stats(const vector<struct iio_stacks_on_socket> &iios, struct iio_counter &ctr,
+                         const std::chrono::steady_clock::time_point start, const uint32_t slice_ms, const uint32_t cycle_ms)
+{
+    // Coverage: measured time over the time between two samples of this counter.
+    double interval_ms = cycle_ms;
+    if (ctr.sampled)
+        interval_ms = std::chrono::duration<double, std::milli>(start - ctr.last_sampled).count();
+    const double coverage = (std::min)(1.0, slice_ms / (std::max)(interval_ms, 1.0));
+
+    double activity = 0.0;
+    const auto key = std::pair<h_id, v_id>(ctr.h_id, ctr.v_id);
+    for (const auto &socket : iios)
+    {
+        for (const auto &stack : socket.stacks)
+        {
+            if (!iio_series_active(socket.socket_id, stack.iio_unit_id, ctr))
+                continue;
+            const double value = iio_series_rate(socket.socket_id, stack.iio_unit_id, ctr);
+            series_stats[socket.socket_id][stack.iio_unit_id][key].update(value, coverage, estimateAlpha);
+            activity += value;
+        }
+    }
+
+    ctr.activity = ctr.sampled ? (1.0 - estimateAlpha) * ctr.activity + estimateAlpha * activity : activity;
+    ctr.idle = (activity == 0.0);
+    ctr.sampled = true;
+    ctr.last_sampled = start;
+    ctr.sampled_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Samples only the event groups that are due; they share the delay among themselves.
+void collect_data(PCM *m, const double delay, vector<struct iio_stacks_on_socket> &iios, vector<struct iio_counter> &ctrs,
+                  const vector<struct iio_event_group> &groups, MultiRateSchedule &schedule)
+{
+    const std::vector<size_t> due = schedule.waitForDue();
+    std::vector<size_t> due_ctrs;
+    for (auto group : due)
+        due_ctrs.insert(due_ctrs.end(), groups[group].ctrs.begin(), groups[group].ctrs.end());
+    if (due_ctrs.empty())
+        return;
+
+    const uint32_t cycle_ms = uint32_t(delay * 1000);
+    for (const auto &slice : plan_slices(ctrs, due_ctrs, cycle_ms))
+    {
+        auto &ctr = ctrs[slice.first];
+        const auto start = std::chrono::steady_clock::now();
+        ctr.data.clear();
+        result_content sample = get_IIO_Samples(m, iios, ctr, slice.second);
+        ctr.data.push_back(sample);
+        update_series_stats(iios, ctr, start, slice.second, cycle_ms);
+    }
+
+    for (auto group : due)
+        schedule.completed(group);
+}
+
+/*
+ * Aggregation levels of pcm_iio (-levels=<level>[,<level>...]), named as in
+ * the level= scrape filter (exportLevelNames). part is the measured per-part
+ * series. stack, socket and system are rollups labelled with their level: the
+ * sum of the measured rates of an event over the parts of a stack, the stacks
+ * of a socket and the sockets of the node. An event counted per stack
+ * (part="Total") is measured at the stack level: its series is exported with
+ * part or stack and takes no stack rollup. Every pcm_iio series carries its
+ * level, so sum() over one level never counts a value twice.
+ */
+enum iio_level
+{
+    iio_level_part,
+    iio_level_stack,
+    iio_level_socket,
+    iio_level_system,
+    iio_level_count
+};
+
+const char *iio_level_names[iio_level_count] = {"part", "stack", "socket", "system"};
+
+uint32_t iioLevels = 1u << iio_level_part;
+
+// Parses "<level>[,<level>...]" as given to -levels=; node is an alias of system.
+bool parse_iio_levels(const std::string &spec, uint32_t &levels)
+{
+    levels = 0;
+    std::stringstream ss(spec);
+    std::string name;
+    while (std::getline(ss, name, ','))
+    {
+        name = canonicalExportLevel(name);
+        int level = 0;
+        while (level < iio_level_count && name != iio_level_names[level])
+            ++level;
+        if (level == iio_level_count)
+            return false;
+        levels |= 1u << level;
+    }
+    return levels != 0;
+}
+
+// Level of the measured series of <ctr>, its level label in pcm_iio.
+iio_level iio_measured_level(const struct iio_counter &ctr)
+{
+    return iio_counter_part(ctr) < 0 ? iio_level_stack : iio_level_part;
+}
+
+// Whether the measured series of <ctr> is exported with <levels>: with part, or with its own level.
+bool iio_measured_exported(const struct iio_counter &ctr, uint32_t levels)
+{
+    return (levels & ((1u << iio_level_part) | (1u << iio_measured_level(ctr)))) != 0;
+}
+
+/*
+ * Burst mode (-burst=<ms>): a few bandwidth events are programmed once, one per
+ * IIO counter, as stack totals (the channel masks of all parts ORed together)
+ * and read every <ms> without multiplexing. Every export window keeps the
+ * per-poll rates of each (socket, stack, event) and reports p50/p99/max.
+ */
+uint32_t burstIntervalMs = 0; // 0: multiplexed sampling
+// Range of -burst=<ms>: shorter polls would keep a core busy reading MSRs, longer ones miss the bursts.
+constexpr uint32_t minBurstIntervalMs = 10;
+constexpr uint32_t maxBurstIntervalMs = 50;
+std::vector<std::string> burstEventNames = {"IB write", "IB read", "OB read", "OB write"};
+
+struct iio_burst_event
+{
+    std::string name; // hname
+    uint64_t ccr = 0;
+    int idx = -1;     // IIO counter the event is programmed on
+    int multiplier = 1;
+    int divider = 1;
+};
+
+// Burst statistics of one (socket, stack, event) over an export window, in bytes per second.
+struct iio_burst_window
+{
+    uint32_t socket_id;
+    uint32_t stack_id;
+    size_t event;
+    size_t polls; // 0: no poll completed in the window, the quantiles are not set
+    double p50, p99, max;
+};
+
+// Parses "<hname>[,<hname>...]" as given to -burst-events=.
+bool parse_burst_events(const std::string &spec, std::vector<std::string> &names)
+{
+    names.clear();
+    std::stringstream ss(spec);
+    std::string name;
+    while (std::getline(ss, name, ','))
+    {
+        if (!name.empty())
+            names.push_back(name);
+    }
+    return !names.empty() && names.size() <= 4;
+}
+
+/*
+ * Turns the per-part counters named in <names> into stack-total events. Each
+ * event takes the first counter index its part counters are defined for that
+ * is still free; the opCode files put the inbound events on counters 0/1 and
+ * the outbound ones on 2/3.
+ */
+bool build_burst_events(const vector<struct iio_counter> &ctrs, const std::vector<std::string> &names, std::vector<iio_burst_event> &events)
+{
+    std::set<int> used;
+    events.clear();
+    for (const auto &name : names)
+    {
+        iio_burst_event ev;
+        ev.name = name;
+        std::set<int> candidates;
+        for (const auto &ctr : ctrs)
+        {
+            if (ctr.h_event_name != name || iio_counter_part(ctr) < 0)
+                continue;
+            ev.ccr |= ctr.ccr;
+            ev.multiplier = ctr.multiplier;
+            ev.divider = ctr.divider;
+            candidates.insert(ctr.idx);
+        }
+        for (const int idx : candidates)
+        {
+            if (used.count(idx) == 0)
+            {
+                ev.idx = idx;
+                break;
+            }
+        }
+        if (candidates.empty())
+        {
+            std::cerr << "Burst event '" << name << "' is not a per-part event of this CPU" << std::endl;
+            return false;
+        }
+        if (ev.idx < 0)
+        {
+            std::cerr << "No free IIO counter for burst event '" << name << "'" << std::endl;
+            return false;
+        }
+        used.insert(ev.idx);
+        events.push_back(ev);
+    }
+    return true;
+}
+
+class iio_burst_sampler
+{
+    struct series
+    {
+        uint32_t socket_id;
+        uint32_t stack_id;
+        size_t event;
+        uint64_t last = 0;
+        std::vector<double> rates; // bytes per second of every poll in the window
+    };
+
+    PCM *m;
+    std::vector<iio_burst_event> events;
+    std::vector<series> all;
+    std::chrono::steady_clock::time_point last_poll;
+    double busy = 0.0; // seconds spent reading the counters since take_busy()
+
+    // Nearest-rank quantile of sorted values.
+    static double quantile(const std::vector<double> &sorted, double q)
+    {
+        const size_t rank = (size_t)std::ceil(q * sorted.size());
+        return sorted[rank == 0 ? 0 : rank - 1];
+    }
+
+    void read(std::vector<uint64_t> &raw)
+    {
+        const IIOCounterState zero;
+        SnapshotPriorityGuard snapshotPriority;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < all.size(); ++i)
+            raw[i] = getNumberOfEvents(zero, m->getIIOCounterState(all[i].socket_id, all[i].stack_id, events[all[i].event].idx));
+        last_poll = std::chrono::steady_clock::now();
+        busy += std::chrono::duration<double>(last_poll - start).count();
+    }
+
+public:
+    iio_burst_sampler(PCM *m_, const std::vector<struct iio_stacks_on_socket> &iios, const std::vector<iio_burst_event> &events_) : m(m_), events(events_)
+    {
+        for (const auto &socket : iios)
+            for (const auto &stack : socket.stacks)
+                for (size_t e = 0; e < events.size(); ++e)
+                    all.push_back(series{socket.socket_id, stack.iio_unit_id, e, 0, std::vector<double>()});
+    }
+
+    // Programs the events once and takes the first reading.
+    void program()
+    {
+        uint64 rawEvents[4] = {0};
+        for (auto &ev : events)
+        {
+            auto ccrCopy = ev.ccr;
+            std::unique_ptr<ccr> pccr(get_ccr(m, ccrCopy));
+            rawEvents[ev.idx] = pccr->get_ccr_value();
+        }
+        m->programIIOCounters(rawEvents);
+        std::vector<uint64_t> raw(all.size());
+        read(raw);
+        for (size_t i = 0; i < all.size(); ++i)
+            all[i].last = raw[i];
+    }
+
+    void poll()
+    {
+        const auto previous = last_poll;
+        std::vector<uint64_t> raw(all.size());
+        read(raw);
+        const double elapsed = std::chrono::duration<double>(last_poll - previous).count();
+        if (elapsed <= 0.0)
+            return;
+        for (size_t i = 0; i < all.size(); ++i)
+        {
+            const auto &ev = events[all[i].event];
+            const uint64_t delta = counterDelta(all[i].last, raw[i], uncoreCounterWidth(UncorePmu::iio));
+            all[i].rates.push_back((double)(delta * ev.multiplier) / ev.divider / elapsed);
+            all[i].last = raw[i];
+        }
+    }
+
+    // Polls every burstIntervalMs for <window> seconds.
+    void sample(double window)
+    {
+        const auto interval = std::chrono::milliseconds(burstIntervalMs);
+        const auto end = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(window));
+        auto next = std::chrono::steady_clock::now() + interval;
+        while (next <= end)
+        {
+            std::this_thread::sleep_until(next);
+            poll();
+            next += interval;
+            // After an overrun continue at the next slot instead of polling back to back.
+            while (next < std::chrono::steady_clock::now())
+                next += interval;
+        }
+    }
+
+    // Statistics of the polls since the previous call, one entry per series.
+    std::vector<iio_burst_window> take_window()
+    {
+        std::vector<iio_burst_window> windows;
+        for (auto &s : all)
+        {
+            if (s.rates.empty())
+            {
+                windows.push_back(iio_burst_window{s.socket_id, s.stack_id, s.event, 0, 0.0, 0.0, 0.0});
+                continue;
+            }
+            std::sort(s.rates.begin(), s.rates.end());
+            windows.push_back(iio_burst_window{s.socket_id, s.stack_id, s.event, s.rates.size(), quantile(s.rates, 0.5), quantile(s.rates, 0.99), s.rates.back()});
+            s.rates.clear();
+        }
+        return windows;
+    }
+
+    // Seconds the sampling thread spent reading the counters since the previous call.
+    double take_busy()
+    {
+        const double seconds = busy;
+        busy = 0.0;
+        return seconds;
+    }
+};
+
+// Whether discovery found every socket, each with at least one stack.
+bool iio_topology_complete(PCM *m, const std::vector<struct iio_stacks_on_socket> &iios)
+{
+    if (iios.size() != m->getNumSockets())
+        return false;
+    for (const auto &socket : iios)
+    {
+        if (socket.stacks.empty())
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Fills iios from the topology cache when it is valid, otherwise by discovery
+ * (through the sysfs index first, then by a full config space scan) and saves
+ * the result to the cache.
+ */
+bool discover_iio_topology(PCM *m, IPlatformMapping &mapping, const std::string &topology_cache, std::vector<struct iio_stacks_on_socket> &iios)
+{
+    std::string topology_cache_key;
+    if (!topology_cache.empty())
+    {
+        topology_cache_key = topologyCacheKey(m);
+        if (readTopologyCache(topology_cache, topology_cache_key, iios))
+        {
+            std::cout << "[INFO] Loaded PCI topology from " << topology_cache << std::endl;
+            return true;
+        }
+    }
+
+    bool discovered = mapping.pciTreeDiscover(iios) && iio_topology_complete(m, iios);
+    if (!discovered && usePciSysfsIndex())
+    {
+        // Firmware may hide devices from the kernel; retry with a full config space scan.
+        std::cout << "[INFO] PCI discovery through sysfs failed or is incomplete, probing the config space" << std::endl;
+        iios.clear();
+        sysfsPciDiscovery = false;
+        discovered = mapping.pciTreeDiscover(iios);
+    }
+    if (!discovered)
+        return false;
+    if (!topology_cache.empty() && writeTopologyCache(topology_cache, topology_cache_key, iios))
+    {
+        std::cout << "[INFO] Saved PCI topology to " << topology_cache << std::endl;
+    }
+    return true;
+}
+
+// Parses the opCode file into evt_ctx.ctrs. Throws on a malformed file.
+void load_iio_events(PCM *m, const string &ev_file_name, iio_evt_parse_context &evt_ctx, map<string, std::pair<h_id, std::map<string, v_id>>> &nameMap)
+{
+    map<string, uint32_t> opcodeFieldMap;
+    opcodeFieldMap["opcode"] = PCM::OPCODE;
+    opcodeFieldMap["ev_sel"] = PCM::EVENT_SELECT;
+    opcodeFieldMap["umask"] = PCM::UMASK;
+    opcodeFieldMap["reset"] = PCM::RESET;
+    opcodeFieldMap["edge_det"] = PCM::EDGE_DET;
+    opcodeFieldMap["ignored"] = PCM::IGNORED;
+    opcodeFieldMap["overflow_enable"] = PCM::OVERFLOW_ENABLE;
+    opcodeFieldMap["en"] = PCM::ENABLE;
+    opcodeFieldMap["invert"] = PCM::INVERT;
+    opcodeFieldMap["thresh"] = PCM::THRESH;
+    opcodeFieldMap["ch_mask"] = PCM::CH_MASK;
+    opcodeFieldMap["fc_mask"] = PCM::FC_MASK;
+    opcodeFieldMap["hname"] = PCM::H_EVENT_NAME;
+    opcodeFieldMap["vname"] = PCM::V_EVENT_NAME;
+    opcodeFieldMap["multiplier"] = PCM::MULTIPLIER;
+    opcodeFieldMap["divider"] = PCM::DIVIDER;
+    opcodeFieldMap["ctr"] = PCM::COUNTER_INDEX;
+
+    evt_ctx.m = m;
+    evt_ctx.ctrs.clear(); // fill the ctrs by evt_handler call back func.
+    nameMap.clear();
+
+    load_events(ev_file_name, opcodeFieldMap, iio_evt_parse_handler, (void *)&evt_ctx, nameMap);
+}
+
+// Fills evt_ctx.ctrs from the event table built into the binary; false if the CPU model has none.
+bool load_embedded_iio_events(PCM *m, iio_evt_parse_context &evt_ctx, map<string, std::pair<h_id, std::map<string, v_id>>> &nameMap)
+{
+    const int model = m->getCPUFamilyModel();
+    const iio_event_table *table = nullptr;
+    for (const auto &t : iio_event_tables)
+    {
+        if (t.cpu_model == model)
+            table = &t;
+    }
+    if (!table)
+        return false;
+
+    evt_ctx.m = m;
+    evt_ctx.ctrs.clear();
+    nameMap.clear();
+    for (size_t i = 0; i < table->count; ++i)
+    {
+        const iio_event_def &ev = table->events[i];
+        // Same id assignment as load_events: in order of first appearance.
+        auto h = nameMap.find(ev.hname);
+        if (h == nameMap.end())
+            h = nameMap.insert(std::make_pair(string(ev.hname), std::make_pair((h_id)nameMap.size(), std::map<string, v_id>()))).first;
+        auto v = h->second.second.find(ev.vname);
+        if (v == h->second.second.end())
+            v = h->second.second.insert(std::make_pair(string(ev.vname), (v_id)h->second.second.size())).first;
+
+        struct iio_counter ctr;
+        ctr.h_event_name = ev.hname;
+        ctr.v_event_name = ev.vname;
+        ctr.ccr = ev.ccr;
+        ctr.idx = ev.idx;
+        ctr.multiplier = ev.multiplier;
+        ctr.divider = ev.divider;
+        ctr.h_id = h->second.first;
+        ctr.v_id = v->second;
+#ifdef PCM_DEBUG
+        // The compile time encoding must match the ccr classes of PCM.
+        uint64_t expected = 0;
+        {
+            std::unique_ptr<ccr> pccr(get_ccr(m, expected));
+            pccr->set_event_select(ev.fields.ev_sel);
+            pccr->set_umask(ev.fields.umask);
+            pccr->set_reset(ev.fields.reset);
+            pccr->set_edge(ev.fields.edge_det);
+            pccr->set_ov_en(ev.fields.overflow_enable);
+            pccr->set_enable(ev.fields.enable);
+            pccr->set_invert(ev.fields.invert);
+            pccr->set_thresh(ev.fields.thresh);
+            pccr->set_ch_mask(ev.fields.ch_mask);
+            pccr->set_fc_mask(ev.fields.fc_mask);
+        }
+        if (expected != ev.ccr)
+        {
+            std::cerr << "Embedded ccr of " << ev.hname << "/" << ev.vname << " is 0x" << std::hex << ev.ccr
+                      << ", PCM encodes 0x" << expected << std::dec << "\n";
+            exit(EXIT_FAILURE);
+        }
+#endif
+        evt_ctx.ctrs.push_back(ctr);
+    }
+    return true;
+}
+
+/*
+ * Uses the embedded table of the CPU model unless an events file is given;
+ * models without a table still read opCode-<model>.txt from the working directory.
+ * Returns where the events came from.
+ */
+string load_iio_event_definitions(PCM *m, const string &events_file, iio_evt_parse_context &evt_ctx,
+                                  map<string, std::pair<h_id, std::map<string, v_id>>> &nameMap)
+{
+    if (events_file.empty() && load_embedded_iio_events(m, evt_ctx, nameMap))
+        return "built-in table";
+    const string file = events_file.empty() ? "opCode-" + std::to_string(m->getCPUFamilyModel()) + ".txt" : events_file;
+    load_iio_events(m, file, evt_ctx, nameMap);
+    return file;
+}
+
+void print_PCIeMapping(const std::vector<struct iio_stacks_on_socket> &iios, const PciIdDatabase &pciDB, std::ostream &stream)
 {
     uint32_t header_width = 100;
     string row;
@@ -2054,6 +2856,27 @@ void print_usage(const string &progname)
     cout << "  -root-port | /root-port            => add root port devices to output (for csv only)\n";
     cout << "  -list | --list                     => provide platform topology info\n";
     cout << "  -i[=number] | /i[=number]          => allow to determine number of iterations\n";
+    cout << "  -pci-discovery=<sysfs|probe>       => find PCI devices through /sys/bus/pci/devices (default) or by probing\n"
+         << "                                        the whole config space\n";
+    cout << "  -discovery-threads=<n>             => probe PCI domains and root buses with <n> threads (default: up to 8)\n";
+    cout << "  -topology-cache=<file>             => reuse the PCI topology saved in <file>; rediscover and rewrite it\n"
+         << "                                        when the CPU model, BIOS version or PCI device list changed\n";
+    cout << "  -events=<file>                     => read the event definitions from <file> (opCode format) instead of\n"
+         << "                                        the built-in table of the CPU model\n";
+    cout << "  -all                               => sample and export all stacks and parts, including the ones without devices\n";
+    cout << "  -adaptive                          => weight the multiplexing slices by recent traffic\n";
+    cout << "  -min-revisit=<cycles>              => with -adaptive, sample idle events at least every <cycles> (default 5)\n";
+    cout << "  -period=<class|event>:<seconds>    => sample an event class (bandwidth, iommu) or a single event (hname)\n"
+         << "                                        with its own period, e.g. -period=iommu:30\n";
+    cout << "  -burst=<ms>                        => burst mode: read the burst events as stack totals every <ms> (10-50)\n"
+         << "                                        without multiplexing and export p50/p99/max per interval\n";
+    cout << "  -burst-events=<hname>[,<hname>...] => burst events, at most 4 (default: IB write,IB read,OB read,OB write)\n";
+    cout << "  -levels=<level>[,<level>...]       => pcm_iio levels to export: part (measured series, default), stack, socket,\n"
+         << "                                        system (node); stack/socket/system are rollups with a level label,\n"
+         << "                                        events counted per stack are exported with part or stack\n";
+    print_affinity_options_help();
+    print_exposition_options_help();
+    print_summary_options_help();
     cout << " Examples:\n";
     cout << "  " << progname << " 1.0 -i=10             => print counters every second 10 times and exit\n";
     cout << "  " << progname << " 0.5 -csv=test.log     => twice a second save counter values to test.log in CSV format\n";
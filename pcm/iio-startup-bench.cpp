@@ -0,0 +1,146 @@
+// Startup cost benchmark of the IIO exporter.
+//
+// Replays the startup path (topology load, pruning, event table loading, schedule
+// setup) a number of times against a topology recorded with -topology-cache,
+// and prints per phase min/median/max. PCM is initialized once, it is a singleton.
+//
+//   sudo ./iio-startup-bench.out -topology-cache=iio-topology.cache -i=50
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "cpucounters.h"
+#include "utils.h"
+#include "iio-exporter.h"
+#include "exporter-startup.h"
+
+using namespace pcm;
+
+void print_bench_usage(const string &progname)
+{
+  cout << "\n Usage: \n " << progname << " -topology-cache=<file> [options] \n";
+  cout << " Supported <options> are: \n";
+  cout << "  -h    | --help  | /h               => print this help and exit\n";
+  cout << "  -topology-cache=<file>             => recorded topology (written by pcm-iio-exporter -topology-cache)\n";
+  cout << "  -i=<iterations>                    => number of replays, defaults to 20\n";
+  cout << "  -events=<file>                     => parse <file> instead of using the built-in event table\n";
+  cout << "  -discover                          => run the live PCI discovery instead of loading the recorded topology\n";
+  cout << "\n";
+}
+
+PCM_MAIN_NOTHROW;
+
+int mainThrows(int argc, char *argv[])
+{
+  string program = string(argv[0]);
+  std::string topology_cache;
+  int iterations = 20;
+  bool discover = false;
+  std::string events_file;
+
+  while (argc > 1)
+  {
+    argv++;
+    argc--;
+    std::string arg_value;
+    if (check_argument_equals(*argv, {"--help", "-h", "/h"}))
+    {
+      print_bench_usage(program);
+      exit(EXIT_SUCCESS);
+    }
+    else if (extract_argument_value(*argv, {"-topology-cache", "/topology-cache"}, arg_value))
+    {
+      topology_cache = arg_value;
+    }
+    else if (extract_argument_value(*argv, {"-i", "/i"}, arg_value))
+    {
+      iterations = (std::max)(1, atoi(arg_value.c_str()));
+    }
+    else if (extract_argument_value(*argv, {"-events", "/events"}, arg_value))
+    {
+      events_file = arg_value;
+    }
+    else if (check_argument_equals(*argv, {"-discover", "/discover"}))
+    {
+      discover = true;
+    }
+    else if (parsePciDiscoveryArg(*argv) || parseDiscoveryThreadsArg(*argv))
+    {
+      continue;
+    }
+    else
+    {
+      cerr << "Unknown option: " << *argv << "\n";
+      print_bench_usage(program);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  const std::string recorded_key = readTopologyCacheKey(topology_cache);
+  if (!discover && recorded_key.empty())
+  {
+    cerr << "No recorded topology in '" << topology_cache << "'\n";
+    print_bench_usage(program);
+    exit(EXIT_FAILURE);
+  }
+
+  StartupTimer init;
+  PCM *m = PCM::getInstance();
+  init.mark("pcm_init");
+  if (!m->IIOEventsAvailable())
+  {
+    cerr << "This CPU is not supported by PCM IIO tool! Program aborted\n";
+    exit(EXIT_FAILURE);
+  }
+  auto mapping = IPlatformMapping::getPlatformMapping(m->getCPUFamilyModel(), m->getNumSockets());
+  if (discover && !mapping)
+  {
+    cerr << "Failed to discover pci tree: unknown platform" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  std::map<std::string, std::vector<double>> samples;
+  std::vector<std::string> order;
+  for (int i = 0; i < iterations; ++i)
+  {
+    StartupTimer startup;
+    std::vector<struct iio_stacks_on_socket> iios;
+    if (discover ? !mapping->pciTreeDiscover(iios) : !readTopologyCache(topology_cache, recorded_key, iios))
+    {
+      cerr << "Failed to load the topology\n";
+      exit(EXIT_FAILURE);
+    }
+    startup.mark(discover ? "pci_discovery" : "topology_cache");
+
+    prune_iio_topology(iios);
+    startup.mark("topology_pruning");
+
+    iio_evt_parse_context evt_ctx;
+    map<string, std::pair<h_id, std::map<string, v_id>>> nameMap;
+    load_iio_event_definitions(m, events_file, evt_ctx, nameMap);
+    startup.mark("load_events");
+
+    prune_iio_counters(evt_ctx.ctrs);
+    MultiRateSchedule schedule;
+    build_event_groups(evt_ctx.ctrs, std::map<string, double>(), 1.0, schedule);
+    startup.mark("setup");
+
+    for (const auto &phase : startup.getPhases())
+    {
+      if (samples.count(phase.first) == 0)
+        order.push_back(phase.first);
+      samples[phase.first].push_back(phase.second);
+    }
+  }
+
+  cout << "phase,min_ms,median_ms,max_ms\n";
+  cout << "pcm_init," << init.total() * 1000.0 << ",,\n";
+  for (const auto &phase : order)
+  {
+    auto &values = samples[phase];
+    std::sort(values.begin(), values.end());
+    cout << phase << "," << values.front() * 1000.0 << "," << values[values.size() / 2] * 1000.0 << "," << values.back() * 1000.0 << "\n";
+  }
+  return 0;
+}
@@ -0,0 +1,209 @@
+#pragma once
+// Persistent cache of the discovered IIO/PCIe topology.
+//
+// Brute-force discovery probes every domain x bus x device x function and takes
+// seconds on large systems. The resulting iio_stacks_on_socket tree is written
+// to a text file and reused on the next start, as long as the CPU model, the
+// BIOS version and the set of PCI devices listed in sysfs are unchanged.
+
+#include <dirent.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "lspci.h"
+
+const std::string topologyCacheMagic = "pcm-iio-topology 1";
+
+std::string readFirstLine(const std::string &path)
+{
+  std::ifstream in(path);
+  std::string line;
+  if (in.is_open())
+    std::getline(in, line);
+  return line;
+}
+
+// FNV-1a over the sorted BDF names in /sys/bus/pci/devices: changes when a device is added, removed or moved.
+std::string pciFingerprint()
+{
+  std::vector<std::string> names;
+  DIR *dir = opendir("/sys/bus/pci/devices");
+  if (dir)
+  {
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+      if (entry->d_name[0] != '.')
+        names.push_back(entry->d_name);
+    }
+    closedir(dir);
+  }
+  std::sort(names.begin(), names.end());
+
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const auto &name : names)
+  {
+    for (const char c : name + "\n")
+    {
+      hash ^= (uint8_t)c;
+      hash *= 0x100000001b3ULL;
+    }
+  }
+  std::ostringstream ss;
+  ss << names.size() << "-" << std::hex << hash;
+  return ss.str();
+}
+
+// Cache validation key: CPU family/model/stepping, BIOS version, PCI fingerprint.
+std::string topologyCacheKey(pcm::PCM *m)
+{
+  return m->getCPUFamilyModelString() + " bios=" + readFirstLine("/sys/class/dmi/id/bios_version") + " pci=" + pciFingerprint();
+}
+
+void writePciDevice(std::ostream &out, const struct pcm::pci &dev)
+{
+  out << "pci " << dev.bdf.domainno << " " << (uint32_t)dev.bdf.busno << " " << (uint32_t)dev.bdf.devno << " " << (uint32_t)dev.bdf.funcno
+      << " " << dev.exist << " " << dev.offset_0 << " " << (int)dev.header_type << " " << dev.offset_18 << " " << dev.link_info
+      << " " << dev.parts_no.size();
+  for (const auto part : dev.parts_no)
+    out << " " << part;
+  out << " " << dev.child_pci_devs.size() << "\n";
+  for (const auto &child : dev.child_pci_devs)
+    writePciDevice(out, child);
+}
+
+bool readPciDevice(std::istream &in, struct pcm::pci &dev)
+{
+  std::string tag;
+  uint32_t domain, bus, device, function;
+  int header_type;
+  size_t parts, children;
+  if (!(in >> tag >> domain >> bus >> device >> function >> dev.exist >> dev.offset_0 >> header_type >> dev.offset_18 >> dev.link_info >> parts) || tag != "pci")
+    return false;
+  dev.bdf = pcm::bdf(domain, bus, device, function);
+  dev.header_type = (int8_t)header_type;
+  dev.parts_no.resize(parts);
+  for (auto &part : dev.parts_no)
+  {
+    if (!(in >> part))
+      return false;
+  }
+  if (!(in >> children))
+    return false;
+  dev.child_pci_devs.resize(children);
+  for (auto &child : dev.child_pci_devs)
+  {
+    if (!readPciDevice(in, child))
+      return false;
+  }
+  return true;
+}
+
+bool writeTopologyCache(const std::string &path, const std::string &key, const std::vector<struct pcm::iio_stacks_on_socket> &iios)
+{
+  const std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios_base::out | std::ios_base::trunc);
+    if (!out.is_open())
+    {
+      std::cerr << "Cannot write the topology cache " << tmp << "\n";
+      return false;
+    }
+    out << topologyCacheMagic << "\n"
+        << key << "\n"
+        << iios.size() << "\n";
+    for (const auto &socket : iios)
+    {
+      out << "socket " << socket.socket_id << " " << socket.stacks.size() << "\n";
+      for (const auto &stack : socket.stacks)
+      {
+        // The stack name may contain spaces, it takes the rest of the line.
+        out << "stack " << stack.iio_unit_id << " " << stack.domain << " " << (uint32_t)stack.busno << " " << stack.flipped
+            << " " << stack.parts.size() << " " << stack.stack_name << "\n";
+        for (const auto &part : stack.parts)
+        {
+          out << "part " << part.part_id << " " << part.child_pci_devs.size() << "\n";
+          writePciDevice(out, part.root_pci_dev);
+          for (const auto &dev : part.child_pci_devs)
+            writePciDevice(out, dev);
+        }
+      }
+    }
+    if (!out.good())
+      return false;
+  }
+  // Readers never see a partially written cache.
+  return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+// Key recorded in a cache file, empty if it is not one. Used to replay a topology recorded on another node.
+std::string readTopologyCacheKey(const std::string &path)
+{
+  std::ifstream in(path);
+  std::string magic, key;
+  if (!in.is_open() || !std::getline(in, magic) || magic != topologyCacheMagic || !std::getline(in, key))
+    return std::string();
+  return key;
+}
+
+// Returns false when the file is missing, malformed or recorded on a different system.
+bool readTopologyCache(const std::string &path, const std::string &key, std::vector<struct pcm::iio_stacks_on_socket> &iios)
+{
+  std::ifstream in(path);
+  if (!in.is_open())
+    return false;
+
+  std::string magic, cached_key;
+  if (!std::getline(in, magic) || magic != topologyCacheMagic || !std::getline(in, cached_key))
+    return false;
+  if (cached_key != key)
+  {
+    std::cout << "[INFO] Topology cache " << path << " is stale (" << cached_key << " != " << key << ")" << std::endl;
+    return false;
+  }
+
+  std::vector<struct pcm::iio_stacks_on_socket> cached;
+  size_t sockets;
+  if (!(in >> sockets))
+    return false;
+  cached.resize(sockets);
+  for (auto &socket : cached)
+  {
+    std::string tag;
+    size_t stacks;
+    if (!(in >> tag >> socket.socket_id >> stacks) || tag != "socket")
+      return false;
+    socket.stacks.resize(stacks);
+    for (auto &stack : socket.stacks)
+    {
+      uint32_t busno;
+      size_t parts;
+      if (!(in >> tag >> stack.iio_unit_id >> stack.domain >> busno >> stack.flipped >> parts) || tag != "stack")
+        return false;
+      stack.busno = (uint8_t)busno;
+      in.ignore(1);
+      std::getline(in, stack.stack_name);
+      stack.parts.resize(parts);
+      for (auto &part : stack.parts)
+      {
+        size_t devs;
+        if (!(in >> tag >> part.part_id >> devs) || tag != "part" || !readPciDevice(in, part.root_pci_dev))
+          return false;
+        part.child_pci_devs.resize(devs);
+        for (auto &dev : part.child_pci_devs)
+        {
+          if (!readPciDevice(in, dev))
+            return false;
+        }
+      }
+    }
+  }
+  iios.swap(cached);
+  return true;
+}
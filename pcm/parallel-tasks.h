@@ -0,0 +1,76 @@
+#pragma once
+// Minimal fork-join pool for the startup phase (PCI discovery).
+//
+// Tasks are indices 0..count-1 pulled from a shared counter; each task writes
+// only to its own result slot, the caller merges the slots in index order so
+// the outcome does not depend on scheduling. An exception thrown by a task is
+// rethrown in the calling thread after all workers have joined.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils.h"
+
+// -discovery-threads=N, 1 runs the tasks in the calling thread.
+unsigned discoveryThreads = (std::max)(1U, (std::min)(8U, std::thread::hardware_concurrency()));
+
+void runParallel(size_t count, unsigned threads, const std::function<void(size_t)> &task)
+{
+  threads = (unsigned)(std::min)((size_t)threads, count);
+  if (threads <= 1)
+  {
+    for (size_t i = 0; i < count; ++i)
+      task(i);
+    return;
+  }
+
+  std::atomic<size_t> next(0);
+  std::vector<std::exception_ptr> errors(count);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; ++t)
+  {
+    workers.emplace_back([&]()
+                         {
+                           for (size_t i = next++; i < count; i = next++)
+                           {
+                             try
+                             {
+                               task(i);
+                             }
+                             catch (...)
+                             {
+                               errors[i] = std::current_exception();
+                             }
+                           } });
+  }
+  for (auto &worker : workers)
+    worker.join();
+  // As in the sequential case, the exception of the lowest failing task reaches the caller.
+  for (const auto &error : errors)
+  {
+    if (error)
+      std::rethrow_exception(error);
+  }
+}
+
+bool parseDiscoveryThreadsArg(const char *arg)
+{
+  std::string arg_value;
+  if (!pcm::extract_argument_value(arg, {"-discovery-threads", "/discovery-threads"}, arg_value))
+    return false;
+  const int threads = atoi(arg_value.c_str());
+  if (threads < 1)
+  {
+    std::cerr << "Invalid number of discovery threads: " << arg_value << "\n";
+    exit(EXIT_FAILURE);
+  }
+  discoveryThreads = (unsigned)threads;
+  return true;
+}
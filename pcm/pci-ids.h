@@ -0,0 +1,164 @@
+#pragma once
+// Lazy PCI ID database.
+//
+// load_PCIDB() parses the whole pci.ids (about 1.5 MB, tens of thousands of
+// entries) into maps at every start, while the exporter names a handful of
+// devices at most, and only for -list. This version maps the file read-only and
+// resolves a vendor or device name on its first lookup; only the names that
+// were asked for are kept.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+
+class PciIdDatabase
+{
+  mutable bool opened = false;
+  mutable const char *data = nullptr;
+  mutable size_t size = 0;
+  mutable std::map<uint16_t, size_t> vendorLines; // vendor id => offset of its line, npos if absent
+  mutable std::map<uint32_t, std::string> deviceNames;
+
+  PciIdDatabase(const PciIdDatabase &) = delete;
+  PciIdDatabase &operator=(const PciIdDatabase &) = delete;
+
+  void open() const
+  {
+    opened = true;
+    for (const char *path : {"pci.ids", "/usr/share/hwdata/pci.ids", "/usr/share/misc/pci.ids"})
+    {
+      const int fd = ::open(path, O_RDONLY);
+      if (fd < 0)
+        continue;
+      struct stat st;
+      if (fstat(fd, &st) == 0 && st.st_size > 0)
+      {
+        void *addr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED)
+        {
+          data = (const char *)addr;
+          size = (size_t)st.st_size;
+        }
+      }
+      ::close(fd);
+      if (data)
+        return;
+    }
+  }
+
+  size_t nextLine(size_t pos) const
+  {
+    const void *eol = memchr(data + pos, '\n', size - pos);
+    return eol ? (size_t)((const char *)eol - data) + 1 : size;
+  }
+
+  // "<hex id>  <name>" starting at pos, 4 hex digits.
+  bool parseEntry(size_t pos, uint16_t &id, std::string &name) const
+  {
+    if (pos + 6 > size)
+      return false;
+    char hex[5] = {data[pos], data[pos + 1], data[pos + 2], data[pos + 3], 0};
+    char *end = nullptr;
+    id = (uint16_t)strtoul(hex, &end, 16);
+    if (end != hex + 4 || data[pos + 4] != ' ')
+      return false;
+    const size_t eol = nextLine(pos);
+    size_t first = pos + 4;
+    while (first < eol && data[first] == ' ')
+      ++first;
+    size_t last = eol;
+    while (last > first && (data[last - 1] == '\n' || data[last - 1] == '\r'))
+      --last;
+    name.assign(data + first, last - first);
+    return true;
+  }
+
+  // Vendors are sorted, the scan stops at the first larger id or at the class section.
+  size_t findVendor(uint16_t vendor_id) const
+  {
+    const auto cached = vendorLines.find(vendor_id);
+    if (cached != vendorLines.end())
+      return cached->second;
+
+    size_t found = std::string::npos;
+    for (size_t pos = 0; data && pos < size; pos = nextLine(pos))
+    {
+      const char c = data[pos];
+      if (c == '#' || c == '\t' || c == '\n')
+        continue;
+      if (c == 'C' && pos + 1 < size && data[pos + 1] == ' ')
+        break;
+      uint16_t id;
+      std::string name;
+      if (!parseEntry(pos, id, name))
+        continue;
+      if (id == vendor_id)
+        found = pos;
+      if (id >= vendor_id)
+        break;
+    }
+    vendorLines[vendor_id] = found;
+    return found;
+  }
+
+public:
+  PciIdDatabase() = default;
+  ~PciIdDatabase()
+  {
+    if (data)
+      munmap((void *)data, size);
+  }
+
+  // Empty when the vendor (or the pci.ids file) is unknown.
+  std::string vendorName(uint16_t vendor_id) const
+  {
+    if (!opened)
+      open();
+    const size_t pos = findVendor(vendor_id);
+    uint16_t id;
+    std::string name;
+    if (pos == std::string::npos || !parseEntry(pos, id, name))
+      return std::string();
+    return name;
+  }
+
+  std::string deviceName(uint16_t vendor_id, uint16_t device_id) const
+  {
+    if (!opened)
+      open();
+    const uint32_t key = ((uint32_t)vendor_id << 16) | device_id;
+    const auto cached = deviceNames.find(key);
+    if (cached != deviceNames.end())
+      return cached->second;
+
+    std::string &result = deviceNames[key];
+    const size_t vendor = findVendor(vendor_id);
+    if (vendor == std::string::npos)
+      return result;
+    // Devices are "\t<id>  <name>", subsystems "\t\t..." are skipped.
+    for (size_t pos = nextLine(vendor); pos < size; pos = nextLine(pos))
+    {
+      const char c = data[pos];
+      if (c == '#' || c == '\n')
+        continue;
+      if (c != '\t')
+        break;
+      if (pos + 1 >= size || data[pos + 1] == '\t')
+        continue;
+      uint16_t id;
+      std::string name;
+      if (parseEntry(pos + 1, id, name) && id == device_id)
+      {
+        result = name;
+        break;
+      }
+    }
+    return result;
+  }
+};
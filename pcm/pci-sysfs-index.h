@@ -0,0 +1,110 @@
+#pragma once
+// Index of the PCI functions the kernel enumerated in /sys/bus/pci/devices.
+//
+// The platform mappings look for devices by probing every domain x bus x device
+// x function through config space, which costs tens of thousands of reads. With
+// the index a probe of a function the kernel does not know about is answered
+// without touching config space; only the functions that exist are read.
+
+#include <dirent.h>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "lspci.h"
+#include "utils.h"
+
+class PciSysfsIndex
+{
+  std::set<uint64_t> functions; // sorted like the brute-force loops: domain, bus, device, function
+
+  static uint64_t key(uint32_t domain, uint32_t bus, uint32_t device, uint32_t function)
+  {
+    return ((uint64_t)domain << 16) | ((bus & 0xff) << 8) | ((device & 0x1f) << 3) | (function & 0x7);
+  }
+
+public:
+  bool load(const char *path = "/sys/bus/pci/devices")
+  {
+    functions.clear();
+    DIR *dir = opendir(path);
+    if (!dir)
+      return false;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+      uint32_t domain, bus, device, function;
+      if (sscanf(entry->d_name, "%x:%x:%x.%x", &domain, &bus, &device, &function) == 4)
+        functions.insert(key(domain, bus, device, function));
+    }
+    closedir(dir);
+    return !functions.empty();
+  }
+
+  bool empty() const { return functions.empty(); }
+  size_t size() const { return functions.size(); }
+
+  bool contains(const struct pcm::bdf &address) const
+  {
+    return functions.count(key(address.domainno, address.busno, address.devno, address.funcno)) != 0;
+  }
+
+  // Functions on buses [first_bus, last_bus] of a domain, in bus/device/function order.
+  std::vector<struct pcm::bdf> functionsInRange(uint32_t domain, uint32_t first_bus, uint32_t last_bus) const
+  {
+    std::vector<struct pcm::bdf> result;
+    if (first_bus > last_bus)
+      return result;
+    const auto end = functions.upper_bound(key(domain, last_bus, 31, 7));
+    for (auto it = functions.lower_bound(key(domain, first_bus, 0, 0)); it != end; ++it)
+      result.push_back(pcm::bdf((uint32_t)(*it >> 16), (*it >> 8) & 0xff, (*it >> 3) & 0x1f, *it & 0x7));
+    return result;
+  }
+};
+
+// -pci-discovery=sysfs (default) consults the index before probing, =probe scans config space.
+bool sysfsPciDiscovery = true;
+
+PciSysfsIndex &pciSysfsIndex()
+{
+  static PciSysfsIndex index;
+  static const bool loaded = index.load();
+  (void)loaded;
+  return index;
+}
+
+// Whether lookups should go through the index; false when sysfs is not available.
+bool usePciSysfsIndex()
+{
+  return sysfsPciDiscovery && !pciSysfsIndex().empty();
+}
+
+// probe_pci() for functions the kernel enumerated; the rest is reported missing without a config read.
+// Only for the PCIe tree: uncore register functions (UBOX/CPUBUSNO, MESH2IIO/SAD,
+// PCU, MSM) may be hidden from the kernel by the BIOS and are probed with probe_pci().
+bool probe_present_pci(struct pcm::pci *p)
+{
+  if (usePciSysfsIndex() && !pciSysfsIndex().contains(p->bdf))
+    return false;
+  return pcm::probe_pci(p);
+}
+
+bool parsePciDiscoveryArg(const char *arg)
+{
+  std::string arg_value;
+  if (!pcm::extract_argument_value(arg, {"-pci-discovery", "/pci-discovery"}, arg_value))
+    return false;
+  if (arg_value == "sysfs")
+    sysfsPciDiscovery = true;
+  else if (arg_value == "probe")
+    sysfsPciDiscovery = false;
+  else
+  {
+    std::cerr << "Invalid PCI discovery mode: " << arg_value << " (expected sysfs or probe)\n";
+    exit(EXIT_FAILURE);
+  }
+  return true;
+}
@@ -8,6 +8,12 @@
 #include <string>
 #include <assert.h>
 #include "pcie-exporter.h"
+#include "exporter-startup.h"
+#include "byte-counter.h"
+#include "sampling-estimate.h"
+#include "window-summary.h"
+#include "bandwidth-histogram.h"
+#include "exposition-server.h"
 
 #include <prometheus/exposer.h>
 #include <prometheus/registry.h>
@@ -24,6 +30,7 @@ IPlatform *IPlatform::getPlatform(PCM *m, bool csv, bool print_bandwidth, bool p
 {
   switch (m->getCPUFamilyModel())
   {
+  case PCM::GNR:
   case PCM::SRF:
     std::cout << "Birch" << std::endl;
     return new BirchStreamPlatform(m, csv, print_bandwidth, print_additional_info, delay);
@@ -61,23 +68,75 @@ void signalHandler(int signum)
   keep_running = false;
 }
 
+void print_usage(const string &progname)
+{
+  cout << "\n Usage: \n " << progname << " --help | [options] \n";
+  cout << " Supported <options> are: \n";
+  cout << "  -h    | --help  | /h               => print this help and exit\n";
+  cout << "  -period=<seconds>                  => collection period, defaults to 10 seconds\n";
+  print_affinity_options_help();
+  print_exposition_options_help();
+  print_summary_options_help();
+  cout << "\n";
+}
+
 int main(int argc, char *argv[])
 {
   if (print_version(argc, argv))
     exit(EXIT_SUCCESS);
 
+  string program = string(argv[0]);
+  double period = 10.0;
+  while (argc > 1)
+  {
+    argv++;
+    argc--;
+    std::string arg_value;
+    if (check_argument_equals(*argv, {"--help", "-h", "/h"}))
+    {
+      print_usage(program);
+      exit(EXIT_SUCCESS);
+    }
+    else if (extract_argument_value(*argv, {"-period", "/period"}, arg_value))
+    {
+      period = atof(arg_value.c_str());
+      if (period <= 0.0)
+      {
+        cerr << "Invalid period: " << arg_value << "\n";
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if (parseAffinityArg(*argv) || parseSummaryWindowArg(*argv) || parseExpositionArg(*argv) || parseSparseArg(*argv))
+    {
+      continue;
+    }
+    else
+    {
+      cerr << "Unknown option: " << *argv << "\n";
+      print_usage(program);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // Must precede the creation of the HTTP server threads, they inherit the mask.
+  if (!applyHousekeepingAffinity())
+    exit(EXIT_FAILURE);
+
   // Register signal handler for graceful shutdown
   std::signal(SIGINT, signalHandler);
   std::signal(SIGTERM, signalHandler);
 
+  StartupTimer startup;
+
   // Create a Prometheus exporter
-  prometheus::Exposer exposer{"0.0.0.0:9402"};
+  MetricsEndpoint exposer{"0.0.0.0:9402"};
 
   // Create a metrics registry
   auto registry = std::make_shared<prometheus::Registry>();
 
   // Add the metrics registry to the exposer
   exposer.RegisterCollectable(registry);
+  startup.mark("exposer");
 
   // Create gauge metrics for PCIe bandwidths
   auto &pcie_bandwidth_family = prometheus::BuildGauge()
@@ -88,8 +147,22 @@ int main(int argc, char *argv[])
   auto &read_bw_gauge = pcie_bandwidth_family.Add({{"direction", "read"}});
   auto &write_bw_gauge = pcie_bandwidth_family.Add({{"direction", "write"}});
 
-  // Create the platform
+  auto &pcie_bytes_family = prometheus::BuildCounter()
+                                .Name("pcie_bytes_total")
+                                .Help("PCIe bytes, extrapolated over the time between samples")
+                                .Register(*registry);
+  IntegratedCounter read_bytes(pcie_bytes_family.Add({{"direction", "read"}}));
+  IntegratedCounter write_bytes(pcie_bytes_family.Add({{"direction", "write"}}));
+
   double delay = 1.0; // Default delay of 1 second
+
+  auto bandwidth_window = std::make_shared<WindowSummary>("pcie_bandwidth_window", "PCIe bandwidth in bytes per second, summary of the samples over the window",
+                                                          summaryWindowFor((std::max)(period, delay)));
+  exposer.RegisterCollectable(bandwidth_window);
+  const size_t read_window = bandwidth_window->add({{"direction", "read"}});
+  const size_t write_window = bandwidth_window->add({{"direction", "write"}});
+
+  // Create the platform
   bool csv = false;
   bool print_bandwidth = true;
   bool print_additional_info = false;
@@ -99,6 +172,7 @@ int main(int argc, char *argv[])
     std::cerr << "Can't access PCM counters or failed to initialize PCM." << std::endl;
     exit(EXIT_FAILURE);
   }
+  startup.mark("pcm_init");
 
   unique_ptr<IPlatform> platform(IPlatform::getPlatform(m, csv, print_bandwidth, print_additional_info, (uint)(delay * 1000)));
   if (!platform)
@@ -106,27 +180,140 @@ int main(int argc, char *argv[])
     std::cerr << "Unsupported CPU model or failed to create platform." << std::endl;
     exit(EXIT_FAILURE);
   }
+  // The platform constructor programs the uncore events.
+  startup.mark("program");
+
+  // Distribution of the per-interval bandwidth per socket, aggregatable across nodes
+  auto &socket_bandwidth_family = prometheus::BuildHistogram()
+                                      .Name("pcie_socket_bandwidth_bytes_per_second")
+                                      .Help("PCIe bandwidth per socket in bytes per second, one observation per sampling interval")
+                                      .Register(*registry);
+  std::vector<prometheus::Histogram *> socket_read_hist, socket_write_hist;
+  for (uint32 socket = 0; socket < m->getNumSockets(); ++socket)
+  {
+    socket_read_hist.push_back(&socket_bandwidth_family.Add({{"socket", std::to_string(socket)}, {"direction", "read"}}, bandwidthBuckets()));
+    socket_write_hist.push_back(&socket_bandwidth_family.Add({{"socket", std::to_string(socket)}, {"direction", "write"}}, bandwidthBuckets()));
+  }
+
+  // Estimate quality: all events share the duty cycle, the error is per series
+  auto &coverage_gauge = prometheus::BuildGauge()
+                             .Name("pcie_coverage_ratio")
+                             .Help("Fraction of wall time every PCIe event was measured (multiplexing duty cycle)")
+                             .Register(*registry)
+                             .Add({});
+  auto &pcie_error_family = prometheus::BuildGauge()
+                                .Name("pcie_relative_error")
+                                .Help("Estimated relative error of the extrapolated PCIe bandwidth")
+                                .Register(*registry);
+  auto &read_error_gauge = pcie_error_family.Add({{"direction", "read"}});
+  auto &write_error_gauge = pcie_error_family.Add({{"direction", "write"}});
+  SamplingEstimate read_estimate, write_estimate;
+
+  // CPU-initiated MMIO traffic per socket: requests per second and a bandwidth estimate at 64 bytes per request
+  auto &outbound_requests_family = prometheus::BuildGauge()
+                                       .Name("pcie_outbound_requests")
+                                       .Help("CPU-initiated MMIO requests to PCIe devices per second")
+                                       .Register(*registry);
+  auto &outbound_bandwidth_family = prometheus::BuildGauge()
+                                        .Name("pcie_outbound_bandwidth")
+                                        .Help("Estimated CPU-initiated MMIO bandwidth in bytes per second (64 bytes per request)")
+                                        .Register(*registry);
+  auto &outbound_bytes_family = prometheus::BuildCounter()
+                                    .Name("pcie_outbound_bytes_total")
+                                    .Help("Estimated CPU-initiated MMIO bytes (64 bytes per request), extrapolated over the time between samples")
+                                    .Register(*registry);
+  std::vector<prometheus::Gauge *> outbound_read_requests, outbound_write_requests, outbound_read_bw, outbound_write_bw;
+  std::vector<IntegratedCounter> outbound_read_bytes, outbound_write_bytes;
+  auto &outbound_error_family = prometheus::BuildGauge()
+                                    .Name("pcie_outbound_relative_error")
+                                    .Help("Estimated relative error of the extrapolated CPU-initiated MMIO request rate")
+                                    .Register(*registry);
+  std::vector<prometheus::Gauge *> outbound_read_error, outbound_write_error;
+  std::vector<SamplingEstimate> outbound_read_estimate, outbound_write_estimate;
+  if (platform->hasOutbound())
+  {
+    for (uint32 socket = 0; socket < m->getNumSockets(); ++socket)
+    {
+      const std::string skt = std::to_string(socket);
+      outbound_read_requests.push_back(&outbound_requests_family.Add({{"socket", skt}, {"direction", "read"}}));
+      outbound_write_requests.push_back(&outbound_requests_family.Add({{"socket", skt}, {"direction", "write"}}));
+      outbound_read_bw.push_back(&outbound_bandwidth_family.Add({{"socket", skt}, {"direction", "read"}}));
+      outbound_write_bw.push_back(&outbound_bandwidth_family.Add({{"socket", skt}, {"direction", "write"}}));
+      outbound_read_bytes.push_back(IntegratedCounter(outbound_bytes_family.Add({{"socket", skt}, {"direction", "read"}})));
+      outbound_write_bytes.push_back(IntegratedCounter(outbound_bytes_family.Add({{"socket", skt}, {"direction", "write"}})));
+      outbound_read_error.push_back(&outbound_error_family.Add({{"socket", skt}, {"direction", "read"}}));
+      outbound_write_error.push_back(&outbound_error_family.Add({{"socket", skt}, {"direction", "write"}}));
+    }
+    outbound_read_estimate.resize(outbound_read_requests.size());
+    outbound_write_estimate.resize(outbound_read_requests.size());
+  }
+  startup.print(std::cout);
+  startup.publish(*registry);
 
   // Start the Prometheus exporter
   std::cout << "\n------\n[INFO] Starting Prometheus exporter on port: 9402" << std::endl;
+  exposer.publish();
+
+  MultiRateSchedule schedule;
+  schedule.add("pcie", (std::max)(period, delay));
 
   // Monitoring loop
+  IntegratedCounter::clock::time_point previous_sample;
   while (keep_running)
   {
+    schedule.waitForDue();
     platform->getEvents();
+    const auto sampled = IntegratedCounter::clock::now();
+    // Every event is counted for its slice of the window, the window for delay out of the time since the last sample
+    double interval = (std::max)(period, delay);
+    if (previous_sample != IntegratedCounter::clock::time_point())
+      interval = std::chrono::duration<double>(sampled - previous_sample).count();
+    previous_sample = sampled;
+    const double coverage = platform->getDutyCycle() * delay / (std::max)(interval, delay);
+    coverage_gauge.Set(coverage);
 
-    double read_bw = platform->getReadBw();
-    double write_bw = platform->getWriteBw();
+    // Byte totals of the sample are exact; the rate is derived here.
+    double read_bw = platform->getReadBw() / delay;
+    double write_bw = platform->getWriteBw() / delay;
 
     // Update Prometheus gauges
     read_bw_gauge.Set(read_bw);
     write_bw_gauge.Set(write_bw);
+    read_bytes.update(read_bw, delay, sampled);
+    write_bytes.update(write_bw, delay, sampled);
+    bandwidth_window->observe(read_window, read_bw);
+    bandwidth_window->observe(write_window, write_bw);
+    for (uint32 socket = 0; socket < socket_read_hist.size(); ++socket)
+    {
+      socket_read_hist[socket]->Observe(platform->getSocketReadBw(socket) / delay);
+      socket_write_hist[socket]->Observe(platform->getSocketWriteBw(socket) / delay);
+    }
+    read_estimate.update(read_bw, coverage, estimateAlpha);
+    write_estimate.update(write_bw, coverage, estimateAlpha);
+    read_error_gauge.Set(read_estimate.relativeError(estimateAlpha));
+    write_error_gauge.Set(write_estimate.relativeError(estimateAlpha));
+
+    for (uint32 socket = 0; socket < outbound_read_requests.size(); ++socket)
+    {
+      const double reads = platform->getOutboundReads(socket) / delay;
+      const double writes = platform->getOutboundWrites(socket) / delay;
+      outbound_read_requests[socket]->Set(reads);
+      outbound_write_requests[socket]->Set(writes);
+      outbound_read_bw[socket]->Set(reads * 64.0);
+      outbound_write_bw[socket]->Set(writes * 64.0);
+      outbound_read_bytes[socket].update(reads * 64.0, delay, sampled);
+      outbound_write_bytes[socket].update(writes * 64.0, delay, sampled);
+      outbound_read_estimate[socket].update(reads, coverage, estimateAlpha);
+      outbound_write_estimate[socket].update(writes, coverage, estimateAlpha);
+      outbound_read_error[socket]->Set(outbound_read_estimate[socket].relativeError(estimateAlpha));
+      outbound_write_error[socket]->Set(outbound_write_estimate[socket].relativeError(estimateAlpha));
+    }
 
     // Reset the counters
     platform->cleanup();
+    exposer.publish(sampled);
 
-    // Wait for the specified delay (10s)
-    std::this_thread::sleep_for(std::chrono::seconds(10));
+    schedule.completed(0);
   }
 
   std::cout << "[INFO] Exporter stopped. Exiting program." << std::endl;
@@ -11,6 +11,10 @@
 #include <string>
 #include <initializer_list>
 #include <algorithm>
+#include "exporter-affinity.h"
+#include "exporter-schedule.h"
+#include "counter-accumulator.h"
+#include "sampling-estimate.h"
 
 #if defined(_MSC_VER)
 typedef unsigned int uint;
@@ -30,6 +34,15 @@ public:
   virtual void cleanup() = 0;
   virtual uint64 getReadBw() = 0;
   virtual uint64 getWriteBw() = 0;
+  // Bytes of <socket> in the last sample
+  virtual uint64 getSocketReadBw(uint socket) = 0;
+  virtual uint64 getSocketWriteBw(uint socket) = 0;
+  // Fraction of a sampling window every event is counted (events are time-multiplexed)
+  virtual double getDutyCycle() const { return 1.0; }
+  // CPU-initiated MMIO requests to PCIe devices on <socket> in the last sample, 0 where not measured
+  virtual bool hasOutbound() const { return false; }
+  virtual uint64 getOutboundReads(uint socket) { return 0; }
+  virtual uint64 getOutboundWrites(uint socket) { return 0; }
   static IPlatform *getPlatform(PCM *m, bool csv, bool bandwidth,
                                 bool verbose, uint32 delay);
   virtual ~IPlatform() {}
@@ -41,14 +54,6 @@ protected:
   bool m_verbose;
   uint m_socketCount;
 
-  enum eventFilter
-  {
-    TOTAL,
-    MISS,
-    HIT,
-    fltLast
-  };
-
   vector<string> filterNames, bwNames;
 };
 
@@ -90,20 +95,21 @@ class LegacyPlatform : public IPlatform
   vector<string> eventNames;
   vector<eventGroup_t> eventGroups;
   uint32 m_delay;
+  uint32 m_counterWidth; // bits of the CBo/CHA counters
   typedef vector<vector<uint64>> eventCount_t;
   array<eventCount_t, total> eventCount;
 
   virtual void getEvents() final;
-  virtual void cleanup() final;
 
   uint64 getEventCount(uint socket, uint idx);
   uint eventGroupOffset(eventGroup_t &eventGroup);
   void getEventGroup(eventGroup_t &eventGroup);
 
 public:
-  LegacyPlatform(initializer_list<string> events, initializer_list<eventGroup_t> eventCodes,
-                 PCM *m, bool csv, bool bandwidth, bool verbose, uint32 delay) : IPlatform(m, csv, bandwidth, verbose),
-                                                                                 eventNames(events), eventGroups(eventCodes)
+  LegacyPlatform(const vector<string> &events, const vector<eventGroup_t> &eventCodes,
+                 PCM *m, bool csv, bool bandwidth, bool verbose, uint32 delay, uint32 counterWidth) : IPlatform(m, csv, bandwidth, verbose),
+                                                                                                      eventNames(events), eventGroups(eventCodes),
+                                                                                                      m_counterWidth(counterWidth)
   {
     int eventsCount = 0;
     for (auto &group : eventGroups)
@@ -112,9 +118,8 @@ public:
     // Delay for each multiplexing group. Counters will be scaled.
     m_delay = uint32(delay / eventGroups.size() / NUM_SAMPLES);
 
-    eventSample.resize(m_socketCount);
-    for (auto &e : eventSample)
-      e.resize(eventsCount);
+    m_eventsCount = eventsCount;
+    eventSample.resize(m_socketCount * eventsCount);
 
     for (auto &run : eventCount)
     {
@@ -125,22 +130,23 @@ public:
   };
   virtual uint64 getReadBw() = 0;
   virtual uint64 getWriteBw() = 0;
+  virtual void cleanup();
+  virtual double getDutyCycle() const { return 1.0 / eventGroups.size(); }
 
 protected:
-  vector<vector<uint64>> eventSample;
-  virtual uint64 event(uint socket, eventFilter filter, uint idx) = 0;
+  // Accumulated counts, contiguous per socket: [socket * m_eventsCount + raw event index]
+  vector<uint64> eventSample;
+  uint m_eventsCount;
 };
 
 void LegacyPlatform::cleanup()
 {
-  for (auto &socket : eventSample)
-    fill(socket.begin(), socket.end(), 0);
+  fill(eventSample.begin(), eventSample.end(), 0);
 }
 
 inline uint64 LegacyPlatform::getEventCount(uint skt, uint idx)
 {
-  return eventGroups.size() * (eventCount[after][skt][idx] -
-                               eventCount[before][skt][idx]);
+  return eventGroups.size() * counterDelta(eventCount[before][skt][idx], eventCount[after][skt][idx], m_counterWidth);
 }
 
 uint LegacyPlatform::eventGroupOffset(eventGroup_t &eventGroup)
@@ -161,16 +167,19 @@ void LegacyPlatform::getEventGroup(eventGroup_t &eventGroup)
 
   for (int run = before; run < total; run++)
   {
-    for (uint skt = 0; skt < m_socketCount; ++skt)
-      for (uint ctr = 0; ctr < eventGroup.size(); ++ctr)
-        eventCount[run][skt][ctr + offset] = m_pcm->getPCIeCounterData(skt, ctr);
+    {
+      SnapshotPriorityGuard snapshotPriority;
+      for (uint skt = 0; skt < m_socketCount; ++skt)
+        for (uint ctr = 0; ctr < eventGroup.size(); ++ctr)
+          eventCount[run][skt][ctr + offset] = m_pcm->getPCIeCounterData(skt, ctr);
+    }
     if (run == before)
       MySleepMs(m_delay);
   }
 
   for (uint skt = 0; skt < m_socketCount; ++skt)
     for (uint idx = offset; idx < offset + eventGroup.size(); ++idx)
-      eventSample[skt][idx] += getEventCount(skt, idx);
+      eventSample[skt * m_eventsCount + idx] += getEventCount(skt, idx);
 }
 
 void LegacyPlatform::getEvents()
@@ -179,375 +188,261 @@ void LegacyPlatform::getEvents()
     getEventGroup(evGroup);
 }
 
-// BHS
-class BirchStreamPlatform : public LegacyPlatform
+/*
+ * Platforms are described by constexpr tables instead of per-class event()
+ * switches. A platform definition is a struct with
+ *   events[] - logical events (PCIRdCur, ItoM, ...) with the bytes every event
+ *              contributes to the read and the write bandwidth and whether it
+ *              is a CPU-initiated (outbound, MMIO) read or write,
+ *   raw[]    - uncore events to program: opcode, multiplexing group, the
+ *              logical event and the filter (miss, hit or total) it counts.
+ * Raw events of one group are programmed together and must be adjacent.
+ * TablePlatform<Def> derives every metric in one pass over eventSample.
+ */
+enum pcieFilter
 {
-public:
-  BirchStreamPlatform(PCM *m, bool csv, bool bandwidth, bool verbose, uint32 delay) : LegacyPlatform({"PCIRdCur", "ItoM", "ItoMCacheNear", "UCRdF", "WiL", "WCiL", "WCiLF"},
-                                                                                                     {
-                                                                                                         {0xC8F3FE00000435, 0xC8F3FD00000435, 0xCC43FE00000435, 0xCC43FD00000435},
-                                                                                                         {0xCD43FE00000435, 0xCD43FD00000435, 0xC877DE00000135, 0xC87FDE00000135},
-                                                                                                         {
-                                                                                                             0xC86FFE00000135,
-                                                                                                             0xC867FE00000135,
-                                                                                                         },
-                                                                                                     },
-                                                                                                     m, csv, bandwidth, verbose, delay) {
-                                                                                      };
-  virtual uint64 getReadBw();
-  virtual uint64 getWriteBw();
-
-private:
-  enum eventIdx
-  {
-    PCIRdCur,
-    ItoM,
-    ItoMCacheNear,
-    UCRdF,
-    WiL,
-    WCiL,
-    WCiLF
-  };
-
-  enum Events
-  {
-    PCIRdCur_miss,
-    PCIRdCur_hit,
-    ItoM_miss,
-    ItoM_hit,
-    ItoMCacheNear_miss,
-    ItoMCacheNear_hit,
-    UCRdF_miss,
-    WiL_miss,
-    WCiL_miss,
-    WCiLF_miss,
-    eventLast
-  };
-  virtual uint64 event(uint socket, eventFilter filter, uint idx);
+  pcieTotal,
+  pcieMiss,
+  pcieHit,
+  pcieFilterLast
 };
 
-uint64 BirchStreamPlatform::event(uint socket, eventFilter filter, uint idx)
+enum pcieOutbound
 {
-  uint64 event = 0;
-  switch (idx)
-  {
-  case PCIRdCur:
-    if (filter == TOTAL)
-      event = eventSample[socket][PCIRdCur_miss] +
-              eventSample[socket][PCIRdCur_hit];
-    else if (filter == MISS)
-      event = eventSample[socket][PCIRdCur_miss];
-    else if (filter == HIT)
-      event = eventSample[socket][PCIRdCur_hit];
-    break;
-  case ItoM:
-    if (filter == TOTAL)
-      event = eventSample[socket][ItoM_miss] +
-              eventSample[socket][ItoM_hit];
-    else if (filter == MISS)
-      event = eventSample[socket][ItoM_miss];
-    else if (filter == HIT)
-      event = eventSample[socket][ItoM_hit];
-    break;
-  case ItoMCacheNear:
-    if (filter == TOTAL)
-      event = eventSample[socket][ItoMCacheNear_miss] +
-              eventSample[socket][ItoMCacheNear_hit];
-    else if (filter == MISS)
-      event = eventSample[socket][ItoMCacheNear_miss];
-    else if (filter == HIT)
-      event = eventSample[socket][ItoMCacheNear_hit];
-    break;
-  case UCRdF:
-    if (filter == TOTAL || filter == MISS)
-      event = eventSample[socket][UCRdF_miss];
-    break;
-  case WiL:
-    if (filter == TOTAL || filter == MISS)
-      event = eventSample[socket][WiL_miss];
-    break;
-  case WCiL:
-    if (filter == TOTAL || filter == MISS)
-      event = eventSample[socket][WCiL_miss];
-    break;
-  case WCiLF:
-    if (filter == TOTAL || filter == MISS)
-      event = eventSample[socket][WCiLF_miss];
-    break;
-  default:
-    break;
-  }
-  return event;
-}
+  pcieInbound,       // device-initiated (DMA) or not a PCIe request
+  pcieOutboundRead,  // MMIO read from a core
+  pcieOutboundWrite, // MMIO write from a core
+};
 
-uint64 BirchStreamPlatform::getReadBw()
+struct pcie_event_def
 {
-  uint64 readBw = 0;
-  for (uint socket = 0; socket < m_socketCount; socket++)
-    readBw += (event(socket, TOTAL, PCIRdCur));
-  return (readBw * 64ULL);
-}
+  const char *name;
+  uint32 read_bytes;  // bytes added to the read bandwidth per event
+  uint32 write_bytes; // bytes added to the write bandwidth per event
+  pcieOutbound outbound;
+};
 
-uint64 BirchStreamPlatform::getWriteBw()
+struct pcie_raw_event
 {
-  uint64 writeBw = 0;
-  for (uint socket = 0; socket < m_socketCount; socket++)
-    writeBw += (event(socket, TOTAL, ItoM) +
-                event(socket, TOTAL, ItoMCacheNear));
-  return (writeBw * 64ULL);
-}
+  uint64 opcode;
+  uint32 group; // multiplexing group
+  uint32 event; // index into events[]
+  pcieFilter filter;
+};
 
-// SPR
-class EagleStreamPlatform : public LegacyPlatform
+template <class Def>
+class TablePlatform : public LegacyPlatform
 {
+  static constexpr size_t tableEventCount = sizeof(Def::events) / sizeof(Def::events[0]);
+  static constexpr size_t rawCount = sizeof(Def::raw) / sizeof(Def::raw[0]);
+
+  static constexpr bool hasRaw(uint32 event, pcieFilter filter)
+  {
+    for (size_t r = 0; r < rawCount; ++r)
+      if (Def::raw[r].event == event && Def::raw[r].filter == filter)
+        return true;
+    return false;
+  }
+
+  static constexpr bool hasOutboundEvents()
+  {
+    for (size_t e = 0; e < tableEventCount; ++e)
+      if (Def::events[e].outbound != pcieInbound)
+        return true;
+    return false;
+  }
+
+  // Event names and groups of the table, handed to the LegacyPlatform constructor
+  static vector<string> tableEventNames()
+  {
+    vector<string> names;
+    for (const auto &e : Def::events)
+      names.push_back(e.name);
+    return names;
+  }
+
+  static vector<eventGroup_t> tableEventGroups()
+  {
+    vector<eventGroup_t> groups;
+    for (size_t r = 0; r < rawCount; ++r)
+    {
+      if (r == 0 || Def::raw[r].group != Def::raw[r - 1].group)
+        groups.push_back(eventGroup_t());
+      groups.back().push_back(Def::raw[r].opcode);
+    }
+    return groups;
+  }
+
+  // [socket * tableEventCount + event][filter], valid for the sample m_computed was set for
+  vector<array<uint64, pcieFilterLast>> m_derived;
+  vector<uint64> m_outboundReads, m_outboundWrites; // per socket
+  vector<uint64> m_socketReadBytes, m_socketWriteBytes;
+  uint64 m_readBytes = 0, m_writeBytes = 0;
+  bool m_computed = false;
+
+  void compute()
+  {
+    if (m_computed)
+      return;
+    m_readBytes = m_writeBytes = 0;
+    for (uint skt = 0; skt < m_socketCount; ++skt)
+    {
+      m_outboundReads[skt] = m_outboundWrites[skt] = 0;
+      m_socketReadBytes[skt] = m_socketWriteBytes[skt] = 0;
+      array<array<uint64, pcieFilterLast>, tableEventCount> raw{};
+      const uint64 *sample = &eventSample[skt * rawCount];
+      for (size_t r = 0; r < rawCount; ++r)
+        raw[Def::raw[r].event][Def::raw[r].filter] += sample[r];
+
+      for (uint32 e = 0; e < tableEventCount; ++e)
+      {
+        auto &d = m_derived[skt * tableEventCount + e];
+        d[pcieMiss] = raw[e][pcieMiss];
+        d[pcieHit] = raw[e][pcieHit];
+        d[pcieTotal] = raw[e][pcieTotal];
+        // Platforms count either miss + hit (total derived) or miss + total (hit derived).
+        if (!hasRaw(e, pcieTotal))
+          d[pcieTotal] = d[pcieMiss] + d[pcieHit];
+        else if (!hasRaw(e, pcieHit))
+          d[pcieHit] = d[pcieTotal] > d[pcieMiss] ? d[pcieTotal] - d[pcieMiss] : 0;
+        m_socketReadBytes[skt] += d[pcieTotal] * Def::events[e].read_bytes;
+        m_socketWriteBytes[skt] += d[pcieTotal] * Def::events[e].write_bytes;
+        if (Def::events[e].outbound == pcieOutboundRead)
+          m_outboundReads[skt] += d[pcieTotal];
+        else if (Def::events[e].outbound == pcieOutboundWrite)
+          m_outboundWrites[skt] += d[pcieTotal];
+      }
+      m_readBytes += m_socketReadBytes[skt];
+      m_writeBytes += m_socketWriteBytes[skt];
+    }
+    m_computed = true;
+  }
+
 public:
-  EagleStreamPlatform(PCM *m, bool csv, bool bandwidth, bool verbose, uint32 delay) : LegacyPlatform({"PCIRdCur", "ItoM", "ItoMCacheNear", "UCRdF", "WiL", "WCiL", "WCiLF"},
-                                                                                                     {
-                                                                                                         {0xC8F3FE00000435, 0xC8F3FD00000435, 0xCC43FE00000435, 0xCC43FD00000435},
-                                                                                                         {0xCD43FE00000435, 0xCD43FD00000435, 0xC877DE00000135, 0xC87FDE00000135},
-                                                                                                         {
-                                                                                                             0xC86FFE00000135,
-                                                                                                             0xC867FE00000135,
-                                                                                                         },
-                                                                                                     },
-                                                                                                     m, csv, bandwidth, verbose, delay) {
-                                                                                      };
-
-  virtual uint64 getReadBw();
-  virtual uint64 getWriteBw();
-
-private:
-  enum eventIdx
+  TablePlatform(PCM *m, bool csv, bool bandwidth, bool verbose, uint32 delay) : LegacyPlatform(tableEventNames(), tableEventGroups(), m, csv, bandwidth, verbose, delay, Def::counterWidth),
+                                                                                m_derived(m_socketCount * tableEventCount),
+                                                                                m_outboundReads(m_socketCount), m_outboundWrites(m_socketCount),
+                                                                                m_socketReadBytes(m_socketCount), m_socketWriteBytes(m_socketCount)
   {
-    PCIRdCur,
-    ItoM,
-    ItoMCacheNear,
-    UCRdF,
-    WiL,
-    WCiL,
-    WCiLF
-  };
+  }
 
-  enum Events
+  virtual uint64 getReadBw()
   {
-    PCIRdCur_miss,
-    PCIRdCur_hit,
-    ItoM_miss,
-    ItoM_hit,
-    ItoMCacheNear_miss,
-    ItoMCacheNear_hit,
-    UCRdF_miss,
-    WiL_miss,
-    WCiL_miss,
-    WCiLF_miss,
-    eventLast
-  };
-  virtual uint64 event(uint socket, eventFilter filter, uint idx);
-};
+    compute();
+    return m_readBytes;
+  }
 
-uint64 EagleStreamPlatform::event(uint socket, eventFilter filter, uint idx)
-{
-  uint64 event = 0;
-  switch (idx)
+  virtual uint64 getWriteBw()
   {
-  case PCIRdCur:
-    if (filter == TOTAL)
-      event = eventSample[socket][PCIRdCur_miss] +
-              eventSample[socket][PCIRdCur_hit];
-    else if (filter == MISS)
-      event = eventSample[socket][PCIRdCur_miss];
-    else if (filter == HIT)
-      event = eventSample[socket][PCIRdCur_hit];
-    break;
-  case ItoM:
-    if (filter == TOTAL)
-      event = eventSample[socket][ItoM_miss] +
-              eventSample[socket][ItoM_hit];
-    else if (filter == MISS)
-      event = eventSample[socket][ItoM_miss];
-    else if (filter == HIT)
-      event = eventSample[socket][ItoM_hit];
-    break;
-  case ItoMCacheNear:
-    if (filter == TOTAL)
-      event = eventSample[socket][ItoMCacheNear_miss] +
-              eventSample[socket][ItoMCacheNear_hit];
-    else if (filter == MISS)
-      event = eventSample[socket][ItoMCacheNear_miss];
-    else if (filter == HIT)
-      event = eventSample[socket][ItoMCacheNear_hit];
-    break;
-  case UCRdF:
-    if (filter == TOTAL || filter == MISS)
-      event = eventSample[socket][UCRdF_miss];
-    break;
-  case WiL:
-    if (filter == TOTAL || filter == MISS)
-      event = eventSample[socket][WiL_miss];
-    break;
-  case WCiL:
-    if (filter == TOTAL || filter == MISS)
-      event = eventSample[socket][WCiL_miss];
-    break;
-  case WCiLF:
-    if (filter == TOTAL || filter == MISS)
-      event = eventSample[socket][WCiLF_miss];
-    break;
-  default:
-    break;
+    compute();
+    return m_writeBytes;
   }
-  return event;
-}
 
-uint64 EagleStreamPlatform::getReadBw()
-{
-  uint64 readBw = 0;
-  for (uint socket = 0; socket < m_socketCount; socket++)
-    readBw += (event(socket, TOTAL, PCIRdCur));
-  return (readBw * 64ULL);
-}
+  virtual uint64 getSocketReadBw(uint socket)
+  {
+    compute();
+    return m_socketReadBytes[socket];
+  }
 
-uint64 EagleStreamPlatform::getWriteBw()
-{
-  uint64 writeBw = 0;
-  for (uint socket = 0; socket < m_socketCount; socket++)
-    writeBw += (event(socket, TOTAL, ItoM) +
-                event(socket, TOTAL, ItoMCacheNear));
-  return (writeBw * 64ULL);
-}
+  virtual uint64 getSocketWriteBw(uint socket)
+  {
+    compute();
+    return m_socketWriteBytes[socket];
+  }
+
+  virtual bool hasOutbound() const { return hasOutboundEvents(); }
 
-// ICX
-class WhitleyPlatform : public LegacyPlatform
+  virtual uint64 getOutboundReads(uint socket)
+  {
+    compute();
+    return m_outboundReads[socket];
+  }
+
+  virtual uint64 getOutboundWrites(uint socket)
+  {
+    compute();
+    return m_outboundWrites[socket];
+  }
+
+  virtual void cleanup()
+  {
+    LegacyPlatform::cleanup();
+    m_computed = false;
+  }
+};
+
+// SPR, EMR (Eagle Stream), SRF, GNR (Birch Stream): CHA TOR inserts, (miss, hit) pairs for the PCIe reads and writes, misses only for the MMIO requests
+struct EagleStreamEvents
 {
-public:
-  WhitleyPlatform(PCM *m, bool csv, bool bandwidth, bool verbose, uint32 delay) : LegacyPlatform({"PCIRdCur", "ItoM", "ItoMCacheNear", "UCRdF", "WiL"},
-                                                                                                 {
-                                                                                                     {0xC8F3FE00000435, 0xC8F3FD00000435, 0xCC43FE00000435, 0xCC43FD00000435},
-                                                                                                     {0xCD43FE00000435, 0xCD43FD00000435, 0xC877DE00000135, 0xC87FDE00000135},
-                                                                                                 },
-                                                                                                 m, csv, bandwidth, verbose, delay) {
-                                                                                  };
-
-  virtual uint64 getReadBw();
-  virtual uint64 getWriteBw();
-
-private:
-  enum eventIdx
+  enum
   {
     PCIRdCur,
     ItoM,
     ItoMCacheNear,
     UCRdF,
     WiL,
+    WCiL,
+    WCiLF
   };
-
-  enum Events
-  {
-    PCIRdCur_miss,
-    PCIRdCur_hit,
-    ItoM_miss,
-    ItoM_hit,
-    ItoMCacheNear_miss,
-    ItoMCacheNear_hit,
-    UCRdF_miss,
-    WiL_miss,
-    eventLast
+  static constexpr uint32 counterWidth = 48;
+  static constexpr pcie_event_def events[] = {
+      {"PCIRdCur", 64, 0, pcieInbound},
+      {"ItoM", 0, 64, pcieInbound},
+      {"ItoMCacheNear", 0, 64, pcieInbound},
+      {"UCRdF", 0, 0, pcieOutboundRead},
+      {"WiL", 0, 0, pcieOutboundWrite},
+      {"WCiL", 0, 0, pcieOutboundWrite},
+      {"WCiLF", 0, 0, pcieOutboundWrite},
+  };
+  static constexpr pcie_raw_event raw[] = {
+      {0xC8F3FE00000435, 0, PCIRdCur, pcieMiss},
+      {0xC8F3FD00000435, 0, PCIRdCur, pcieHit},
+      {0xCC43FE00000435, 0, ItoM, pcieMiss},
+      {0xCC43FD00000435, 0, ItoM, pcieHit},
+      {0xCD43FE00000435, 1, ItoMCacheNear, pcieMiss},
+      {0xCD43FD00000435, 1, ItoMCacheNear, pcieHit},
+      {0xC877DE00000135, 1, UCRdF, pcieMiss},
+      {0xC87FDE00000135, 1, WiL, pcieMiss},
+      {0xC86FFE00000135, 2, WCiL, pcieMiss},
+      {0xC867FE00000135, 2, WCiLF, pcieMiss},
   };
-  virtual uint64 event(uint socket, eventFilter filter, uint idx);
 };
 
-uint64 WhitleyPlatform::event(uint socket, eventFilter filter, uint idx)
+// ICX, SNR: as Eagle Stream without WCiL/WCiLF
+struct WhitleyEvents
 {
-  uint64 event = 0;
-  switch (idx)
+  enum
   {
-  case PCIRdCur:
-    if (filter == TOTAL)
-      event = eventSample[socket][PCIRdCur_miss] +
-              eventSample[socket][PCIRdCur_hit];
-    else if (filter == MISS)
-      event = eventSample[socket][PCIRdCur_miss];
-    else if (filter == HIT)
-      event = eventSample[socket][PCIRdCur_hit];
-    break;
-  case ItoM:
-    if (filter == TOTAL)
-      event = eventSample[socket][ItoM_miss] +
-              eventSample[socket][ItoM_hit];
-    else if (filter == MISS)
-      event = eventSample[socket][ItoM_miss];
-    else if (filter == HIT)
-      event = eventSample[socket][ItoM_hit];
-    break;
-  case ItoMCacheNear:
-    if (filter == TOTAL)
-      event = eventSample[socket][ItoMCacheNear_miss] +
-              eventSample[socket][ItoMCacheNear_hit];
-    else if (filter == MISS)
-      event = eventSample[socket][ItoMCacheNear_miss];
-    else if (filter == HIT)
-      event = eventSample[socket][ItoMCacheNear_hit];
-    break;
-  case UCRdF:
-    if (filter == TOTAL || filter == MISS)
-      event = eventSample[socket][UCRdF_miss];
-    break;
-  case WiL:
-    if (filter == TOTAL || filter == MISS)
-      event = eventSample[socket][WiL_miss];
-    break;
-  default:
-    break;
-  }
-  return event;
-}
-
-uint64 WhitleyPlatform::getReadBw()
-{
-  uint64 readBw = 0;
-  for (uint socket = 0; socket < m_socketCount; socket++)
-    readBw += (event(socket, TOTAL, PCIRdCur));
-  return (readBw * 64ULL);
-}
-
-uint64 WhitleyPlatform::getWriteBw()
-{
-  uint64 writeBw = 0;
-  for (uint socket = 0; socket < m_socketCount; socket++)
-    writeBw += (event(socket, TOTAL, ItoM) +
-                event(socket, TOTAL, ItoMCacheNear));
-  return (writeBw * 64ULL);
-}
+    PCIRdCur,
+    ItoM,
+    ItoMCacheNear,
+    UCRdF,
+    WiL
+  };
+  static constexpr uint32 counterWidth = 48;
+  static constexpr pcie_event_def events[] = {
+      {"PCIRdCur", 64, 0, pcieInbound},
+      {"ItoM", 0, 64, pcieInbound},
+      {"ItoMCacheNear", 0, 64, pcieInbound},
+      {"UCRdF", 0, 0, pcieOutboundRead},
+      {"WiL", 0, 0, pcieOutboundWrite},
+  };
+  static constexpr pcie_raw_event raw[] = {
+      {0xC8F3FE00000435, 0, PCIRdCur, pcieMiss},
+      {0xC8F3FD00000435, 0, PCIRdCur, pcieHit},
+      {0xCC43FE00000435, 0, ItoM, pcieMiss},
+      {0xCC43FD00000435, 0, ItoM, pcieHit},
+      {0xCD43FE00000435, 1, ItoMCacheNear, pcieMiss},
+      {0xCD43FD00000435, 1, ItoMCacheNear, pcieHit},
+      {0xC877DE00000135, 1, UCRdF, pcieMiss},
+      {0xC87FDE00000135, 1, WiL, pcieMiss},
+  };
+};
 
-// CLX, SKX
-class PurleyPlatform : public LegacyPlatform
+// CLX, SKX: one event per group, (miss, hit) pairs
+struct PurleyEvents
 {
-public:
-  PurleyPlatform(PCM *m, bool csv, bool bandwidth, bool verbose, uint32 delay) : LegacyPlatform({"PCIRdCur", "RFO", "CRd", "DRd", "ItoM", "PRd", "WiL"},
-                                                                                                {
-                                                                                                    {0x00043c33}, // PCIRdCur_miss
-                                                                                                    {0x00043c37}, // PCIRdCur_hit
-                                                                                                    {0x00040033}, // RFO_miss
-                                                                                                    {0x00040037}, // RFO_hit
-                                                                                                    {0x00040233}, // CRd_miss
-                                                                                                    {0x00040237}, // CRd_hit
-                                                                                                    {0x00040433}, // DRd_miss
-                                                                                                    {0x00040437}, // DRd_hit
-                                                                                                    {0x00049033}, // ItoM_miss
-                                                                                                    {0x00049037}, // ItoM_hit
-                                                                                                    {0x40040e33}, // PRd_miss
-                                                                                                    {0x40040e37}, // PRd_hit
-                                                                                                    {0x40041e33}, // WiL_miss
-                                                                                                    {0x40041e37}, // WiL_hit
-                                                                                                },
-                                                                                                m, csv, bandwidth, verbose, delay) {
-                                                                                 };
-
-  virtual uint64 getReadBw();
-  virtual uint64 getWriteBw();
-
-private:
-  enum eventIdx
+  enum
   {
     PCIRdCur,
     RFO,
@@ -555,92 +450,40 @@ private:
     DRd,
     ItoM,
     PRd,
-    WiL,
+    WiL
   };
-
-  enum Events
-  {
-    PCIRdCur_miss,
-    PCIRdCur_hit,
-    RFO_miss,
-    RFO_hit,
-    CRd_miss,
-    CRd_hit,
-    DRd_miss,
-    DRd_hit,
-    ItoM_miss,
-    ItoM_hit,
-    PRd_miss,
-    PRd_hit,
-    WiL_miss,
-    WiL_hit,
+  static constexpr uint32 counterWidth = 48;
+  static constexpr pcie_event_def events[] = {
+      {"PCIRdCur", 64, 0, pcieInbound},
+      {"RFO", 64, 64, pcieInbound},
+      {"CRd", 64, 0, pcieInbound},
+      {"DRd", 64, 0, pcieInbound},
+      {"ItoM", 0, 64, pcieInbound},
+      {"PRd", 0, 0, pcieOutboundRead},
+      {"WiL", 0, 0, pcieOutboundWrite},
+  };
+  static constexpr pcie_raw_event raw[] = {
+      {0x00043c33, 0, PCIRdCur, pcieMiss},
+      {0x00043c37, 1, PCIRdCur, pcieHit},
+      {0x00040033, 2, RFO, pcieMiss},
+      {0x00040037, 3, RFO, pcieHit},
+      {0x00040233, 4, CRd, pcieMiss},
+      {0x00040237, 5, CRd, pcieHit},
+      {0x00040433, 6, DRd, pcieMiss},
+      {0x00040437, 7, DRd, pcieHit},
+      {0x00049033, 8, ItoM, pcieMiss},
+      {0x00049037, 9, ItoM, pcieHit},
+      {0x40040e33, 10, PRd, pcieMiss},
+      {0x40040e37, 11, PRd, pcieHit},
+      {0x40041e33, 12, WiL, pcieMiss},
+      {0x40041e37, 13, WiL, pcieHit},
   };
-  virtual uint64 event(uint socket, eventFilter filter, uint idx);
 };
 
-uint64 PurleyPlatform::event(uint socket, eventFilter filter, uint idx)
+// BDX, HSX: one event per group, (miss, total) pairs
+struct GrantleyEvents
 {
-  uint64 event = 0;
-  if (filter == TOTAL)
-    event = eventSample[socket][2 * idx] +
-            eventSample[socket][2 * idx + 1];
-  else if (filter == MISS)
-    event = eventSample[socket][2 * idx];
-  else if (filter == HIT)
-    event = eventSample[socket][2 * idx + 1];
-
-  return event;
-}
-
-uint64 PurleyPlatform::getReadBw()
-{
-  uint64 readBw = 0;
-  for (uint socket = 0; socket < m_socketCount; socket++)
-    readBw += (event(socket, TOTAL, PCIRdCur) +
-               event(socket, TOTAL, RFO) +
-               event(socket, TOTAL, CRd) +
-               event(socket, TOTAL, DRd));
-  return (readBw * 64ULL);
-}
-
-uint64 PurleyPlatform::getWriteBw()
-{
-  uint64 writeBw = 0;
-  for (uint socket = 0; socket < m_socketCount; socket++)
-    writeBw += (event(socket, TOTAL, RFO) +
-                event(socket, TOTAL, ItoM));
-  return (writeBw * 64ULL);
-}
-
-// BDX, HSX
-class GrantleyPlatform : public LegacyPlatform
-{
-public:
-  GrantleyPlatform(PCM *m, bool csv, bool bandwidth, bool verbose, uint32 delay) : LegacyPlatform({"PCIRdCur", "RFO", "CRd", "DRd", "ItoM", "PRd", "WiL"},
-                                                                                                  {
-                                                                                                      {0x19e10000}, // PCIRdCur_miss
-                                                                                                      {0x19e00000}, // PCIRdCur_total
-                                                                                                      {0x18030000}, // RFO_miss
-                                                                                                      {0x18020000}, // RFO_total
-                                                                                                      {0x18110000}, // CRd_miss
-                                                                                                      {0x18100000}, // CRd_total
-                                                                                                      {0x18210000}, // DRd_miss
-                                                                                                      {0x18200000}, // DRd_total
-                                                                                                      {0x1c830000}, // ItoM_miss
-                                                                                                      {0x1c820000}, // ItoM_total
-                                                                                                      {0x18710000}, // PRd_miss
-                                                                                                      {0x18700000}, // PRd_total
-                                                                                                      {0x18f10000}, // WiL_miss
-                                                                                                      {0x18f00000}, // WiL_total
-                                                                                                  },
-                                                                                                  m, csv, bandwidth, verbose, delay) {
-                                                                                   };
-
-  virtual uint64 getReadBw();
-  virtual uint64 getWriteBw();
-
-private:
-  enum eventIdx
+  enum
   {
     PCIRdCur,
     RFO,
@@ -648,151 +491,76 @@ private:
     DRd,
     ItoM,
     PRd,
-    WiL,
+    WiL
   };
-
-  enum Events
-  {
-    PCIRdCur_miss,
-    PCIRdCur_total,
-    RFO_miss,
-    RFO_total,
-    CRd_miss,
-    CRd_total,
-    DRd_miss,
-    DRd_total,
-    ItoM_miss,
-    ItoM_total,
-    PRd_miss,
-    PRd_total,
-    WiL_miss,
-    WiL_total,
+  static constexpr uint32 counterWidth = 48;
+  static constexpr pcie_event_def events[] = {
+      {"PCIRdCur", 64, 0, pcieInbound},
+      {"RFO", 64, 64, pcieInbound},
+      {"CRd", 64, 0, pcieInbound},
+      {"DRd", 64, 0, pcieInbound},
+      {"ItoM", 0, 64, pcieInbound},
+      {"PRd", 0, 0, pcieOutboundRead},
+      {"WiL", 0, 0, pcieOutboundWrite},
+  };
+  static constexpr pcie_raw_event raw[] = {
+      {0x19e10000, 0, PCIRdCur, pcieMiss},
+      {0x19e00000, 1, PCIRdCur, pcieTotal},
+      {0x18030000, 2, RFO, pcieMiss},
+      {0x18020000, 3, RFO, pcieTotal},
+      {0x18110000, 4, CRd, pcieMiss},
+      {0x18100000, 5, CRd, pcieTotal},
+      {0x18210000, 6, DRd, pcieMiss},
+      {0x18200000, 7, DRd, pcieTotal},
+      {0x1c830000, 8, ItoM, pcieMiss},
+      {0x1c820000, 9, ItoM, pcieTotal},
+      {0x18710000, 10, PRd, pcieMiss},
+      {0x18700000, 11, PRd, pcieTotal},
+      {0x18f10000, 12, WiL, pcieMiss},
+      {0x18f00000, 13, WiL, pcieTotal},
   };
-  virtual uint64 event(uint socket, eventFilter filter, uint idx);
 };
 
-uint64 GrantleyPlatform::event(uint socket, eventFilter filter, uint idx)
+// IVT, JKT: one event per group, (miss, total) pairs
+struct BromolowEvents
 {
-  uint64 event = 0;
-  if (filter == HIT)
-    if (eventSample[socket][2 * idx] < eventSample[socket][2 * idx + 1])
-      event = eventSample[socket][2 * idx + 1] - eventSample[socket][2 * idx];
-    else
-      event = 0;
-  else if (filter == MISS)
-    event = eventSample[socket][2 * idx];
-  else if (filter == TOTAL)
-    event = eventSample[socket][2 * idx + 1];
-
-  return event;
-}
-
-uint64 GrantleyPlatform::getReadBw()
-{
-  uint64 readBw = 0;
-  for (uint socket = 0; socket < m_socketCount; socket++)
-    readBw += (event(socket, TOTAL, PCIRdCur) +
-               event(socket, TOTAL, RFO) +
-               event(socket, TOTAL, CRd) +
-               event(socket, TOTAL, DRd));
-  return (readBw * 64ULL);
-}
-
-uint64 GrantleyPlatform::getWriteBw()
-{
-  uint64 writeBw = 0;
-  for (uint socket = 0; socket < m_socketCount; socket++)
-    writeBw += (event(socket, TOTAL, RFO) +
-                event(socket, TOTAL, ItoM));
-  return (writeBw * 64ULL);
-}
-
-// IVT, JKT
-class BromolowPlatform : public LegacyPlatform
-{
-public:
-  BromolowPlatform(PCM *m, bool csv, bool bandwidth, bool verbose, uint32 delay) : LegacyPlatform({"PCIeRdCur", "PCIeNSRd", "PCIeWiLF", "PCIeItoM", "PCIeNSWr", "PCIeNSWrF"},
-                                                                                                  {
-                                                                                                      {0x19e10000}, // PCIeRdCur_miss
-                                                                                                      {0x19e00000}, // PCIeRdCur_total
-                                                                                                      {0x1e410000}, // PCIeNSRd_miss
-                                                                                                      {0x1e400000}, // PCIeNSRd_total
-                                                                                                      {0x19410000}, // PCIeWiLF_miss
-                                                                                                      {0x19400000}, // PCIeWiLF_total
-                                                                                                      {0x19c10000}, // PCIeItoM_miss
-                                                                                                      {0x19c00000}, // PCIeItoM_total
-                                                                                                      {0x1e510000}, // PCIeNSWr_miss
-                                                                                                      {0x1e500000}, // PCIeNSWr_total
-                                                                                                      {0x1e610000}, // PCIeNSWrF_miss
-                                                                                                      {0x1e600000}, // PCIeNSWrF_total
-                                                                                                  },
-                                                                                                  m, csv, bandwidth, verbose, delay) {
-                                                                                   };
-
-  virtual uint64 getReadBw();
-  virtual uint64 getWriteBw();
-
-private:
-  enum eventIdx
+  enum
   {
     PCIeRdCur,
     PCIeNSRd,
     PCIeWiLF,
     PCIeItoM,
     PCIeNSWr,
-    PCIeNSWrF,
+    PCIeNSWrF
   };
-
-  enum Events
-  {
-    PCIeRdCur_miss,
-    PCIeRdCur_total,
-    PCIeNSRd_miss,
-    PCIeNSRd_total,
-    PCIeWiLF_miss,
-    PCIeWiLF_total,
-    PCIeItoM_miss,
-    PCIeItoM_total,
-    PCIeNSWr_miss,
-    PCIeNSWr_total,
-    PCIeNSWrF_miss,
-    PCIeNSWrF_total,
+  static constexpr uint32 counterWidth = 44; // CBo counters
+  static constexpr pcie_event_def events[] = {
+      {"PCIeRdCur", 64, 0, pcieInbound},
+      {"PCIeNSRd", 0, 0, pcieInbound},
+      {"PCIeWiLF", 0, 64, pcieInbound},
+      {"PCIeItoM", 0, 64, pcieInbound},
+      {"PCIeNSWr", 64, 64, pcieInbound},
+      {"PCIeNSWrF", 0, 64, pcieInbound},
+  };
+  static constexpr pcie_raw_event raw[] = {
+      {0x19e10000, 0, PCIeRdCur, pcieMiss},
+      {0x19e00000, 1, PCIeRdCur, pcieTotal},
+      {0x1e410000, 2, PCIeNSRd, pcieMiss},
+      {0x1e400000, 3, PCIeNSRd, pcieTotal},
+      {0x19410000, 4, PCIeWiLF, pcieMiss},
+      {0x19400000, 5, PCIeWiLF, pcieTotal},
+      {0x19c10000, 6, PCIeItoM, pcieMiss},
+      {0x19c00000, 7, PCIeItoM, pcieTotal},
+      {0x1e510000, 8, PCIeNSWr, pcieMiss},
+      {0x1e500000, 9, PCIeNSWr, pcieTotal},
+      {0x1e610000, 10, PCIeNSWrF, pcieMiss},
+      {0x1e600000, 11, PCIeNSWrF, pcieTotal},
   };
-  virtual uint64 event(uint socket, eventFilter filter, uint idx);
 };
 
-uint64 BromolowPlatform::event(uint socket, eventFilter filter, uint idx)
-{
-  uint64 event = 0;
-  if (filter == HIT)
-    if (eventSample[socket][2 * idx] < eventSample[socket][2 * idx + 1])
-      event = eventSample[socket][2 * idx + 1] - eventSample[socket][2 * idx];
-    else
-      event = 0;
-  else if (filter == MISS)
-    event = eventSample[socket][2 * idx];
-  else if (filter == TOTAL)
-    event = eventSample[socket][2 * idx + 1];
-
-  return event;
-}
-
-uint64 BromolowPlatform::getReadBw()
-{
-  uint64 readBw = 0;
-  for (uint socket = 0; socket < m_socketCount; socket++)
-    readBw += (event(socket, TOTAL, PCIeRdCur) +
-               event(socket, TOTAL, PCIeNSWr));
-  return (readBw * 64ULL);
-}
-
-uint64 BromolowPlatform::getWriteBw()
-{
-  uint64 writeBw = 0;
-  for (uint socket = 0; socket < m_socketCount; socket++)
-    writeBw += (event(socket, TOTAL, PCIeWiLF) +
-                event(socket, TOTAL, PCIeItoM) +
-                event(socket, TOTAL, PCIeNSWr) +
-                event(socket, TOTAL, PCIeNSWrF));
-  return (writeBw * 64ULL);
-}
+typedef TablePlatform<EagleStreamEvents> EagleStreamPlatform;
+typedef EagleStreamPlatform BirchStreamPlatform;
+typedef TablePlatform<WhitleyEvents> WhitleyPlatform;
+typedef TablePlatform<PurleyEvents> PurleyPlatform;
+typedef TablePlatform<GrantleyEvents> GrantleyPlatform;
+typedef TablePlatform<BromolowEvents> BromolowPlatform;
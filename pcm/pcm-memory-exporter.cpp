@@ -1,14 +1,18 @@
 // pcm-memory-exporter.cpp
+#include <chrono>
 #include <iostream>
 #include <vector>
 #include <string>
 #include <memory>
 #include <prometheus/exposer.h>
 #include <prometheus/registry.h>
+#include <prometheus/counter.h>
 #include <prometheus/gauge.h>
 #include "cpucounters.h"
 #include "utils.h"
 #include "pcm-memory-exporter.h"
+#include "exporter-startup.h"
+#include "sampling-estimate.h"
 
 using namespace std;
 using namespace pcm;
@@ -20,29 +24,73 @@ int mainThrows(int argc, char *argv[])
 	if (print_version(argc, argv))
 		exit(EXIT_SUCCESS);
 
+	string program = string(argv[0]);
+	double delay = 1.0; // Sampling interval in seconds
+	double period = 0.0; // Collection period in seconds, back-to-back sampling by default
+	while (argc > 1)
+	{
+		argv++;
+		argc--;
+		std::string arg_value;
+		if (check_argument_equals(*argv, {"--help", "-h", "/h"}))
+		{
+			print_help(program);
+			exit(EXIT_SUCCESS);
+		}
+		else if (extract_argument_value(*argv, {"-period", "/period"}, arg_value))
+		{
+			period = atof(arg_value.c_str());
+			if (period <= 0.0)
+			{
+				cerr << "Invalid period: " << arg_value << "\n";
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (parseAffinityArg(*argv) || parseSummaryWindowArg(*argv) || parseExpositionArg(*argv) || parseSparseArg(*argv))
+		{
+			continue;
+		}
+		else
+		{
+			cerr << "Unknown option: " << *argv << "\n";
+			print_help(program);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// Must precede the creation of the HTTP server threads, they inherit the mask.
+	if (!applyHousekeepingAffinity())
+		exit(EXIT_FAILURE);
+
 	set_signal_handlers();
 
 	cout << "\n Intel(r) Performance Counter Monitor " << PCM_VERSION << "\n";
 	cout << "\n This utility measures memory bandwidth and exports metrics via Prometheus\n\n";
 
 	// Initialize PCM
+	StartupTimer startup;
 	PCM *m = PCM::getInstance();
+	startup.mark("pcm_init");
 	if (m->program() != PCM::Success)
 	{
 		cerr << "PCM couldn't start. Please check if another instance of PCM is running.\n";
 		exit(EXIT_FAILURE);
 	}
+	startup.mark("program");
 
 	uint32 numSockets = m->getNumSockets();
 
-	// Set up Prometheus Exposer
-	prometheus::Exposer exposer{"0.0.0.0:9404"};
+	// Set up the metrics endpoint
+	MetricsEndpoint exposer{"0.0.0.0:9404"};
 
 	// Create a metrics registry
 	auto registry = std::make_shared<prometheus::Registry>();
 
 	// Add the metrics registry to the exposer
 	exposer.RegisterCollectable(registry);
+	startup.mark("exposer");
+	startup.print(std::cout);
+	startup.publish(*registry);
 
 	// Create gauge metrics for memory bandwidth
 	auto &memory_family = prometheus::BuildGauge()
@@ -67,30 +115,131 @@ int mainThrows(int argc, char *argv[])
 		socketTotalBandwidth[i] = &memory_family.Add({{"socket", std::to_string(i)}, {"type", "total"}, {"level", "socket"}});
 	}
 
+	// Bytes read and written; the memory controller counters run between samples, so they are exact
+	auto &memory_bytes_family = prometheus::BuildCounter()
+									.Name("pcm_memory_bytes_total")
+									.Help("PCM Memory bytes")
+									.Register(*registry);
+	auto &systemReadBytes = memory_bytes_family.Add({{"type", "read"}, {"level", "system"}});
+	auto &systemWriteBytes = memory_bytes_family.Add({{"type", "write"}, {"level", "system"}});
+	std::vector<prometheus::Counter *> socketReadBytes(numSockets), socketWriteBytes(numSockets);
+	for (uint32 i = 0; i < numSockets; ++i)
+	{
+		socketReadBytes[i] = &memory_bytes_family.Add({{"socket", std::to_string(i)}, {"type", "read"}, {"level", "socket"}});
+		socketWriteBytes[i] = &memory_bytes_family.Add({{"socket", std::to_string(i)}, {"type", "write"}, {"level", "socket"}});
+	}
+
+	// Summaries of the samples over the window
+	auto memoryWindow = std::make_shared<WindowSummary>("pcm_memory_bandwidth_window", "PCM Memory Bandwidth in bytes per second, summary of the samples over the window",
+														summaryWindowFor((std::max)(period, delay)));
+	exposer.RegisterCollectable(memoryWindow);
+	const size_t systemReadWindow = memoryWindow->add({{"type", "read"}, {"level", "system"}});
+	const size_t systemWriteWindow = memoryWindow->add({{"type", "write"}, {"level", "system"}});
+	const size_t systemTotalWindow = memoryWindow->add({{"type", "total"}, {"level", "system"}});
+	std::vector<size_t> socketReadWindow(numSockets), socketWriteWindow(numSockets), socketTotalWindow(numSockets);
+	for (uint32 i = 0; i < numSockets; ++i)
+	{
+		socketReadWindow[i] = memoryWindow->add({{"socket", std::to_string(i)}, {"type", "read"}, {"level", "socket"}});
+		socketWriteWindow[i] = memoryWindow->add({{"socket", std::to_string(i)}, {"type", "write"}, {"level", "socket"}});
+		socketTotalWindow[i] = memoryWindow->add({{"socket", std::to_string(i)}, {"type", "total"}, {"level", "socket"}});
+	}
+
+	// Distribution of the per-interval bandwidth per channel, aggregatable across nodes
+	const uint32 numChannels = (uint32)m->getMCChannelsPerSocket();
+	const int cpuFamilyModel = m->getCPUFamilyModel();
+	auto &channel_family = prometheus::BuildHistogram()
+							   .Name("pcm_memory_channel_bandwidth_bytes_per_second")
+							   .Help("PCM Memory Bandwidth per channel in bytes per second, one observation per sampling interval")
+							   .Register(*registry);
+	std::vector<std::vector<prometheus::Histogram *>> channelReadHist(numSockets), channelWriteHist(numSockets);
+	for (uint32 i = 0; i < numSockets; ++i)
+	{
+		for (uint32 channel = 0; channel < numChannels; ++channel)
+		{
+			channelReadHist[i].push_back(&channel_family.Add({{"socket", std::to_string(i)}, {"channel", std::to_string(channel)}, {"type", "read"}}, bandwidthBuckets()));
+			channelWriteHist[i].push_back(&channel_family.Add({{"socket", std::to_string(i)}, {"channel", std::to_string(channel)}, {"type", "write"}}, bandwidthBuckets()));
+		}
+	}
+
+	// Estimate quality: the counters run for delay out of the time between samples
+	auto &coverage_gauge = prometheus::BuildGauge()
+							   .Name("pcm_memory_coverage_ratio")
+							   .Help("Fraction of wall time the memory bandwidth was measured")
+							   .Register(*registry)
+							   .Add({});
+	auto &error_family = prometheus::BuildGauge()
+							 .Name("pcm_memory_relative_error")
+							 .Help("Estimated relative error of the extrapolated memory bandwidth")
+							 .Register(*registry);
+	auto &systemReadError = error_family.Add({{"type", "read"}, {"level", "system"}});
+	auto &systemWriteError = error_family.Add({{"type", "write"}, {"level", "system"}});
+	auto &systemTotalError = error_family.Add({{"type", "total"}, {"level", "system"}});
+	SamplingEstimate systemReadEstimate, systemWriteEstimate, systemTotalEstimate;
+	std::vector<prometheus::Gauge *> socketReadError(numSockets), socketWriteError(numSockets), socketTotalError(numSockets);
+	std::vector<SamplingEstimate> socketReadEstimate(numSockets), socketWriteEstimate(numSockets), socketTotalEstimate(numSockets);
+	for (uint32 i = 0; i < numSockets; ++i)
+	{
+		socketReadError[i] = &error_family.Add({{"socket", std::to_string(i)}, {"type", "read"}, {"level", "socket"}});
+		socketWriteError[i] = &error_family.Add({{"socket", std::to_string(i)}, {"type", "write"}, {"level", "socket"}});
+		socketTotalError[i] = &error_family.Add({{"socket", std::to_string(i)}, {"type", "total"}, {"level", "socket"}});
+	}
+
 	cout << "\n------\n[INFO] Starting Prometheus exporter on port: 9404" << std::endl;
+	exposer.publish();
 
 	MainLoop mainLoop;
-	double delay = 1.0; // Sampling interval in seconds
+	MultiRateSchedule schedule;
+	schedule.add("memory", (std::max)(period, delay));
+	std::chrono::steady_clock::time_point previousSample;
+	// After-states of the previous sample, the start of the byte counter increments
+	SystemCounterState sysPreviousState;
+	std::vector<SocketCounterState> sktPreviousState;
 
 	mainLoop([&]()
 			 {
+        schedule.waitForDue();
+
         // Collect counter states before the delay
-        SystemCounterState sysBeforeState = getSystemCounterState();
+        SystemCounterState sysBeforeState;
         std::vector<SocketCounterState> sktBeforeState(numSockets);
-        for (uint32 i = 0; i < numSockets; ++i)
+        std::vector<ServerUncoreCounterState> uncBeforeState(numSockets);
         {
-            sktBeforeState[i] = getSocketCounterState(i);
+            SnapshotPriorityGuard snapshotPriority;
+            sysBeforeState = getSystemCounterState();
+            for (uint32 i = 0; i < numSockets; ++i)
+            {
+                sktBeforeState[i] = getSocketCounterState(i);
+            }
+            readState(uncBeforeState);
         }
 
         // Sleep for the specified delay
         MySleepMs(static_cast<int>(delay * 1000));
 
         // Collect counter states after the delay
-        SystemCounterState sysAfterState = getSystemCounterState();
+        SystemCounterState sysAfterState;
         std::vector<SocketCounterState> sktAfterState(numSockets);
-        for (uint32 i = 0; i < numSockets; ++i)
+        std::vector<ServerUncoreCounterState> uncAfterState(numSockets);
         {
-            sktAfterState[i] = getSocketCounterState(i);
+            SnapshotPriorityGuard snapshotPriority;
+            sysAfterState = getSystemCounterState();
+            for (uint32 i = 0; i < numSockets; ++i)
+            {
+                sktAfterState[i] = getSocketCounterState(i);
+            }
+            readState(uncAfterState);
+        }
+        const auto sampled = std::chrono::steady_clock::now();
+        double interval = (std::max)(period, delay);
+        if (previousSample != std::chrono::steady_clock::time_point())
+            interval = std::chrono::duration<double>(sampled - previousSample).count();
+        previousSample = sampled;
+        const double coverage = delay / (std::max)(interval, delay);
+        coverage_gauge.Set(coverage);
+        if (sktPreviousState.empty())
+        {
+            sysPreviousState = sysBeforeState;
+            sktPreviousState = sktBeforeState;
         }
 
         // Calculate system-level bandwidth
@@ -102,6 +251,18 @@ int mainThrows(int argc, char *argv[])
         systemReadBandwidth.Set(sysReadBandwidth);
         systemWriteBandwidth.Set(sysWriteBandwidth);
         systemTotalBandwidth.Set(sysTotalBandwidth);
+        systemReadBytes.Increment(getBytesReadFromMC(sysPreviousState, sysAfterState));
+        systemWriteBytes.Increment(getBytesWrittenToMC(sysPreviousState, sysAfterState));
+        sysPreviousState = sysAfterState;
+        memoryWindow->observe(systemReadWindow, sysReadBandwidth);
+        memoryWindow->observe(systemWriteWindow, sysWriteBandwidth);
+        memoryWindow->observe(systemTotalWindow, sysTotalBandwidth);
+        systemReadEstimate.update(sysReadBandwidth, coverage, estimateAlpha);
+        systemWriteEstimate.update(sysWriteBandwidth, coverage, estimateAlpha);
+        systemTotalEstimate.update(sysTotalBandwidth, coverage, estimateAlpha);
+        systemReadError.Set(systemReadEstimate.relativeError(estimateAlpha));
+        systemWriteError.Set(systemWriteEstimate.relativeError(estimateAlpha));
+        systemTotalError.Set(systemTotalEstimate.relativeError(estimateAlpha));
 
         // Calculate and update per-socket bandwidth metrics
         for (uint32 i = 0; i < numSockets; ++i)
@@ -113,8 +274,38 @@ int mainThrows(int argc, char *argv[])
             socketReadBandwidth[i]->Set(sktReadBandwidth);
             socketWriteBandwidth[i]->Set(sktWriteBandwidth);
             socketTotalBandwidth[i]->Set(sktTotalBandwidth);
+            socketReadBytes[i]->Increment(getBytesReadFromMC(sktPreviousState[i], sktAfterState[i]));
+            socketWriteBytes[i]->Increment(getBytesWrittenToMC(sktPreviousState[i], sktAfterState[i]));
+            sktPreviousState[i] = sktAfterState[i];
+            memoryWindow->observe(socketReadWindow[i], sktReadBandwidth);
+            memoryWindow->observe(socketWriteWindow[i], sktWriteBandwidth);
+            memoryWindow->observe(socketTotalWindow[i], sktTotalBandwidth);
+            socketReadEstimate[i].update(sktReadBandwidth, coverage, estimateAlpha);
+            socketWriteEstimate[i].update(sktWriteBandwidth, coverage, estimateAlpha);
+            socketTotalEstimate[i].update(sktTotalBandwidth, coverage, estimateAlpha);
+            socketReadError[i]->Set(socketReadEstimate[i].relativeError(estimateAlpha));
+            socketWriteError[i]->Set(socketWriteEstimate[i].relativeError(estimateAlpha));
+            socketTotalError[i]->Set(socketTotalEstimate[i].relativeError(estimateAlpha));
+
+            for (uint32 channel = 0; channel < numChannels; ++channel)
+            {
+                uint64 reads = getMCCounter(channel, ServerUncorePMUs::EventPosition::READ, uncBeforeState[i], uncAfterState[i]);
+                uint64 writes = getMCCounter(channel, ServerUncorePMUs::EventPosition::WRITE, uncBeforeState[i], uncAfterState[i]);
+                switch (cpuFamilyModel)
+                {
+                case PCM::GNR:
+                case PCM::SRF:
+                    reads += getMCCounter(channel, ServerUncorePMUs::EventPosition::READ2, uncBeforeState[i], uncAfterState[i]);
+                    writes += getMCCounter(channel, ServerUncorePMUs::EventPosition::WRITE2, uncBeforeState[i], uncAfterState[i]);
+                    break;
+                }
+                channelReadHist[i][channel]->Observe(reads * 64 / delay);
+                channelWriteHist[i][channel]->Observe(writes * 64 / delay);
+            }
         }
 
+        exposer.publish(sampled);
+        schedule.completed(0);
         return true; });
 
 	// Clean up PCM resources
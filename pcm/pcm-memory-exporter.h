@@ -24,6 +24,11 @@
 #include <assert.h>
 #include "cpucounters.h"
 #include "utils.h"
+#include "exporter-affinity.h"
+#include "exporter-schedule.h"
+#include "window-summary.h"
+#include "bandwidth-histogram.h"
+#include "exposition-server.h"
 
 #define PCM_DELAY_DEFAULT 1.0 // in seconds
 #define PCM_DELAY_MIN 0.015   // 15 milliseconds is practical on most modern CPUs
@@ -102,6 +107,10 @@ void print_help(const string &prog_name)
   cout << "  --version                          => print application version\n";
   cout << "  -u                                 => update measurements instead of printing new ones\n";
   print_enforce_flush_option_help();
+  cout << "  -period=<seconds>                  => collection period (exporter only), defaults to the delay\n";
+  print_affinity_options_help();
+  print_exposition_options_help();
+  print_summary_options_help();
 #ifdef _MSC_VER
   cout << "  --uninstallDriver | --installDriver=> (un)install driver\n";
 #endif
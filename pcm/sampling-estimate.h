@@ -0,0 +1,58 @@
+#pragma once
+// Estimate quality of a sampled series.
+//
+// The exporters count an event only for part of the time (IIO and PCIe events
+// are time-multiplexed, and with -period the windows are shorter than the
+// period) and extrapolate. A SamplingEstimate tracks the duty cycle of a series
+// and the moving mean and variance of its extrapolated rate, from which the
+// relative error of the exported value is estimated.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// EWMA smoothing of the estimates of every exporter.
+constexpr double estimateAlpha = 0.2;
+
+class SamplingEstimate
+{
+public:
+  bool seeded = false;
+  double mean = 0.0;     // EWMA of the extrapolated rate
+  double variance = 0.0; // EWMA variance of the extrapolated rate
+  double coverage = 0.0; // fraction of wall time the series was actually measured
+  uint64_t samples = 0;
+
+  void update(double value, double duty_cycle, double alpha)
+  {
+    if (!seeded)
+    {
+      mean = value;
+      variance = 0.0;
+      seeded = true;
+    }
+    else
+    {
+      const double diff = value - mean;
+      const double incr = alpha * diff;
+      mean += incr;
+      variance = (1.0 - alpha) * (variance + diff * incr);
+    }
+    coverage = (std::min)(1.0, (std::max)(0.0, duty_cycle));
+    ++samples;
+  }
+
+  /*
+   * Standard error of the mean relative to the mean: stddev / mean / sqrt(n),
+   * with n the samples the EWMA effectively averages ((2 - alpha) / alpha at
+   * most), scaled by sqrt(1 - coverage) since a fully covered interval has no
+   * extrapolation error. 0 while the mean is 0.
+   */
+  double relativeError(double alpha) const
+  {
+    if (!seeded || mean <= 0.0)
+      return 0.0;
+    const double n = (std::min)((double)samples, (2.0 - alpha) / alpha);
+    return std::sqrt(variance) / mean / std::sqrt(n) * std::sqrt(1.0 - coverage);
+  }
+};
@@ -0,0 +1,115 @@
+#pragma once
+// Metric families backed by the sampler's arrays.
+//
+// A prometheus::Gauge per series costs an object with an atomic, a registry
+// entry and a Family::Add() lookup or a stored pointer to copy every value into.
+// A SnapshotCollectable instead holds a label table built once at setup and a
+// flat array of values (family-major) that the sampler writes by index. At the
+// end of a cycle publish() makes the array the snapshot Collect() reads from,
+// so scrapes see the values of one complete cycle. A series can carry the
+// time it was sampled (stamp()), which the OpenMetrics and protobuf formats
+// export as its timestamp.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <prometheus/client_metric.h>
+#include <prometheus/collectable.h>
+
+class SnapshotCollectable : public prometheus::Collectable
+{
+public:
+  // Families and series are added at setup, before the first set(); adding one resets the values.
+  size_t addFamily(const std::string &name, const std::string &help, prometheus::MetricType type = prometheus::MetricType::Gauge)
+  {
+    families.push_back(Family{name, help, type});
+    reset();
+    return families.size() - 1;
+  }
+
+  size_t addSeries(const prometheus::Labels &labels)
+  {
+    std::vector<prometheus::ClientMetric::Label> row;
+    for (const auto &label : labels)
+      row.push_back(prometheus::ClientMetric::Label{label.first, label.second});
+    table.push_back(std::move(row));
+    reset();
+    return table.size() - 1;
+  }
+
+  size_t seriesCount() const { return table.size(); }
+
+  // Sampler side, not synchronized with Collect().
+  void set(size_t family, size_t series, double value) { pending.values[family * table.size() + series] = value; }
+  void stamp(size_t series, int64_t timestamp_ms) { pending.timestamps[series] = timestamp_ms; }
+
+  // Series that were never set are not exported.
+  void publish()
+  {
+    std::atomic_store(&published, std::make_shared<const Snapshot>(pending));
+  }
+
+  std::vector<prometheus::MetricFamily> Collect() const override
+  {
+    const auto snapshot = std::atomic_load(&published);
+    std::vector<prometheus::MetricFamily> result;
+    if (!snapshot || snapshot->values.size() != families.size() * table.size())
+      return result;
+    result.reserve(families.size());
+    const double *value = snapshot->values.data();
+    for (const auto &f : families)
+    {
+      prometheus::MetricFamily family;
+      family.name = f.name;
+      family.help = f.help;
+      family.type = f.type;
+      family.metric.reserve(table.size());
+      for (size_t s = 0; s < table.size(); ++s, ++value)
+      {
+        if (std::isnan(*value))
+          continue;
+        prometheus::ClientMetric metric;
+        metric.label = table[s];
+        metric.timestamp_ms = snapshot->timestamps[s];
+        if (f.type == prometheus::MetricType::Counter)
+          metric.counter.value = *value;
+        else
+          metric.gauge.value = *value;
+        family.metric.push_back(std::move(metric));
+      }
+      if (!family.metric.empty())
+        result.push_back(std::move(family));
+    }
+    return result;
+  }
+
+private:
+  struct Family
+  {
+    std::string name;
+    std::string help;
+    prometheus::MetricType type;
+  };
+
+  struct Snapshot
+  {
+    std::vector<double> values;      // [family * table.size() + series]
+    std::vector<int64_t> timestamps; // [series], 0 for none
+  };
+
+  std::vector<Family> families;
+  std::vector<std::vector<prometheus::ClientMetric::Label>> table;
+  Snapshot pending;
+  std::shared_ptr<const Snapshot> published;
+
+  void reset()
+  {
+    pending.values.assign(families.size() * table.size(), std::numeric_limits<double>::quiet_NaN());
+    pending.timestamps.assign(table.size(), 0);
+  }
+};
@@ -0,0 +1,186 @@
+#pragma once
+// Sparse exposition.
+//
+// Most IIO parts and many memory channels never see traffic, yet every cycle
+// exports them. With -sparse=<windows> the pre-rendered endpoint stops
+// exporting a series once it has been idle for that many consecutive cycles
+// and exports it again in the first cycle it is active. Idle means:
+//
+//   gauge      the value is 0
+//   counter    the value did not change, so a returning counter continues
+//              where it stopped and rate()/increase() stay correct
+//   histogram  the sum did not change (only zeros were observed)
+//   summary    the sum of the window is 0
+//
+// A companion family (follow()) has no idleness of its own: its series are
+// exported exactly when the series with the same labels of its primary family
+// is, so e.g. the estimate quality gauges of a series come and go with it.
+//
+// In the text format Prometheus marks a suppressed series stale. OpenMetrics
+// and protobuf samples carry explicit timestamps, and Prometheus does not mark
+// those series stale: queries keep returning the last sample for the lookback
+// delta (5 minutes by default) after the series was suppressed.
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <prometheus/client_metric.h>
+
+unsigned sparseWindows = 0; // 0: export every series
+
+// -sparse=<windows>
+bool parseSparseArg(const char *arg)
+{
+  const std::string prefix = "-sparse=";
+  const std::string value(arg);
+  if (value.compare(0, prefix.size(), prefix) != 0)
+    return false;
+  const int windows = atoi(value.c_str() + prefix.size());
+  if (windows < 1)
+  {
+    std::cerr << "Invalid sparse window count: " << value.substr(prefix.size()) << "\n";
+    exit(EXIT_FAILURE);
+  }
+  sparseWindows = (unsigned)windows;
+  return true;
+}
+
+void print_sparse_options_help()
+{
+  std::cout << "  -sparse=<windows>                  => stop exporting a series after <windows> idle cycles until it is active again\n";
+}
+
+class SparseExposition
+{
+public:
+  explicit SparseExposition(unsigned windows_) : windows(windows_) {}
+
+  // Exports the series of <companion> only with the series of <primary> that has the same labels.
+  void follow(const std::string &companion, const std::string &primary)
+  {
+    companions[companion] = primary;
+  }
+
+  // Removes the series that have been idle for <windows> cycles, and the families left empty.
+  void apply(std::vector<prometheus::MetricFamily> &families)
+  {
+    // Labels of the exported series of every primary family
+    std::unordered_map<std::string, std::unordered_set<std::string>> exported;
+    for (const auto &companion : companions)
+      exported[companion.second];
+    for (auto &f : families)
+    {
+      if (companions.count(f.name) == 0)
+        suppressIdle(f, exported);
+    }
+    for (auto &f : families)
+    {
+      const auto companion = companions.find(f.name);
+      if (companion == companions.end())
+        continue;
+      const auto &keep = exported[companion->second];
+      f.metric.erase(std::remove_if(f.metric.begin(), f.metric.end(), [&](const prometheus::ClientMetric &m)
+                                    { return keep.count(labelKey(m.label)) == 0; }),
+                     f.metric.end());
+    }
+    families.erase(std::remove_if(families.begin(), families.end(), [](const prometheus::MetricFamily &f)
+                                  { return f.metric.empty(); }),
+                   families.end());
+  }
+
+private:
+  struct State
+  {
+    std::vector<prometheus::ClientMetric::Label> labels;
+    double last;
+    unsigned idle; // consecutive idle cycles
+    bool seeded;
+  };
+
+  const unsigned windows;
+  std::unordered_map<std::string, std::vector<State>> series;
+  std::unordered_map<std::string, std::string> companions; // companion family -> primary family
+
+  // Removes the idle series of <f>; records the labels of the others when <f> is a primary family.
+  void suppressIdle(prometheus::MetricFamily &f, std::unordered_map<std::string, std::unordered_set<std::string>> &exported)
+  {
+    const auto primary = exported.find(f.name);
+    // Families are collected in the same order every cycle, so a series is
+    // usually found at the same position as in the previous cycle.
+    auto &states = series[f.name];
+    if (states.size() < f.metric.size())
+      states.resize(f.metric.size());
+    auto metric = f.metric.begin();
+    for (size_t i = 0; i < f.metric.size(); ++i)
+    {
+      State &state = states[i];
+      const prometheus::ClientMetric &m = f.metric[i];
+      if (!state.seeded || !sameLabels(state.labels, m.label))
+        state = State{m.label, 0.0, 0, false};
+      const double value = tracked(f.type, m);
+      const bool idle = f.type == prometheus::MetricType::Counter || f.type == prometheus::MetricType::Histogram
+                            ? state.seeded && value == state.last
+                            : value == 0.0;
+      state.idle = idle ? state.idle + 1 : 0;
+      state.last = value;
+      state.seeded = true;
+      if (state.idle < windows)
+      {
+        if (primary != exported.end())
+          primary->second.insert(labelKey(m.label));
+        if (&*metric != &f.metric[i])
+          *metric = std::move(f.metric[i]);
+        ++metric;
+      }
+    }
+    f.metric.erase(metric, f.metric.end());
+  }
+
+  static std::string labelKey(const std::vector<prometheus::ClientMetric::Label> &labels)
+  {
+    std::string key;
+    for (const auto &label : labels)
+    {
+      key += label.name;
+      key += '\0';
+      key += label.value;
+      key += '\0';
+    }
+    return key;
+  }
+
+  // The value whose zero (gauges, summaries) or standstill (counters, histograms) is idle.
+  static double tracked(prometheus::MetricType type, const prometheus::ClientMetric &metric)
+  {
+    switch (type)
+    {
+    case prometheus::MetricType::Gauge:
+      return metric.gauge.value;
+    case prometheus::MetricType::Counter:
+      return metric.counter.value;
+    case prometheus::MetricType::Summary:
+      return metric.summary.sample_sum;
+    case prometheus::MetricType::Histogram:
+      return metric.histogram.sample_sum;
+    default:
+      return metric.untyped.value;
+    }
+  }
+
+  static bool sameLabels(const std::vector<prometheus::ClientMetric::Label> &a, const std::vector<prometheus::ClientMetric::Label> &b)
+  {
+    if (a.size() != b.size())
+      return false;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+      if (a[i].name != b[i].name || a[i].value != b[i].value)
+        return false;
+    }
+    return true;
+  }
+};
@@ -0,0 +1,278 @@
+#pragma once
+// Windowed summaries of the sampled series.
+//
+// The gauges only show the last sample at scrape time, everything in between
+// is lost. A WindowSummary keeps min, max, sum, count and a DDSketch of all
+// samples of a series over a fixed window (-summary-window=<seconds>, by default
+// the multiple of the sampling period that is at least 15 s and 4 periods) and
+// is exported as a Prometheus summary of the last complete window:
+// quantile 0 and 1 are the exact min and max, 0.5/0.9/0.99 come from the
+// sketch within its relative accuracy. Every scraper sees the same window.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <prometheus/collectable.h>
+#include <prometheus/client_metric.h>
+
+double summaryWindow = 0.0; // seconds, 0: derived from the sampling period
+const double defaultSummaryWindow = 15.0;
+const unsigned minSummaryPeriods = 4; // samples a window holds at least
+
+// -summary-window=<seconds>
+bool parseSummaryWindowArg(const char *arg)
+{
+  const std::string prefix = "-summary-window=";
+  const std::string value(arg);
+  if (value.compare(0, prefix.size(), prefix) != 0)
+    return false;
+  summaryWindow = atof(value.c_str() + prefix.size());
+  if (summaryWindow <= 0.0)
+  {
+    std::cerr << "Invalid summary window: " << value.substr(prefix.size()) << "\n";
+    exit(EXIT_FAILURE);
+  }
+  return true;
+}
+
+void print_summary_options_help()
+{
+  std::cout << "  -summary-window=<seconds>          => window of the _window summaries (min/max/quantiles), at least 4 sampling periods;\n"
+            << "                                        defaults to the multiple of the period of at least 15 seconds and 4 periods\n";
+}
+
+// Summary window for series sampled every <period> seconds; exits when -summary-window holds fewer than minSummaryPeriods samples.
+double summaryWindowFor(double period)
+{
+  if (summaryWindow == 0.0)
+    return period * (std::max)((double)minSummaryPeriods, std::ceil(defaultSummaryWindow / period - 1e-9));
+  if (summaryWindow < minSummaryPeriods * period)
+  {
+    std::cerr << "Summary window of " << summaryWindow << " s is shorter than " << minSummaryPeriods << " sampling periods of " << period << " s\n";
+    exit(EXIT_FAILURE);
+  }
+  return summaryWindow;
+}
+
+/*
+ * DDSketch with relative accuracy alpha: a value v > 0 falls into bucket
+ * ceil(log_gamma(v)), gamma = (1 + alpha) / (1 - alpha), and every quantile is
+ * reported within alpha of the true value. The buckets are a sorted sparse
+ * store bounded to maxBuckets. At alpha = 0.01 a bucket spans 2%, so 1 B/s to
+ * 1 TB/s takes about 1400 buckets and maxBuckets covers every rate from
+ * minValue up to ~6e17 without merging. Only beyond that are the lowest
+ * buckets merged, and quantiles falling into the merged bucket lose the alpha
+ * guarantee. Values below minValue are counted as zero.
+ */
+class DDSketch
+{
+public:
+  static constexpr double alpha = 0.01;
+  static constexpr size_t maxBuckets = 2048;
+  static constexpr double minValue = 1.0;
+
+  void add(double value)
+  {
+    ++count;
+    if (!(value >= minValue))
+    {
+      ++zeros;
+      return;
+    }
+    insert(key(value), 1);
+  }
+
+  void merge(const DDSketch &other)
+  {
+    count += other.count;
+    zeros += other.zeros;
+    for (const auto &b : other.buckets)
+      insert(b.first, b.second);
+  }
+
+  void clear()
+  {
+    buckets.clear();
+    count = zeros = 0;
+  }
+
+  uint64_t size() const { return count; }
+
+  double quantile(double q) const
+  {
+    if (count == 0)
+      return 0.0;
+    const double rank = q * (count - 1);
+    uint64_t seen = zeros;
+    if (rank < seen)
+      return 0.0;
+    for (const auto &b : buckets)
+    {
+      seen += b.second;
+      if (rank < seen)
+        return 2.0 * std::pow(gamma(), b.first) / (gamma() + 1.0);
+    }
+    return buckets.empty() ? 0.0 : 2.0 * std::pow(gamma(), buckets.back().first) / (gamma() + 1.0);
+  }
+
+private:
+  std::vector<std::pair<int32_t, uint64_t>> buckets; // (key, count), sorted by key
+  uint64_t count = 0;
+  uint64_t zeros = 0;
+
+  static double gamma() { return (1.0 + alpha) / (1.0 - alpha); }
+  static int32_t key(double value) { return (int32_t)std::ceil(std::log(value) / std::log(gamma())); }
+
+  void insert(int32_t k, uint64_t n)
+  {
+    auto it = std::lower_bound(buckets.begin(), buckets.end(), std::make_pair(k, (uint64_t)0));
+    if (it != buckets.end() && it->first == k)
+    {
+      it->second += n;
+      return;
+    }
+    buckets.insert(it, std::make_pair(k, n));
+    if (buckets.size() > maxBuckets)
+    {
+      // Collapse the two lowest buckets.
+      buckets[1].second += buckets[0].second;
+      buckets.erase(buckets.begin());
+    }
+  }
+};
+
+// Min, max, sum, count and sketch of the samples of one window.
+struct WindowStats
+{
+  uint64_t count = 0;
+  double sum = 0.0;
+  double min = std::numeric_limits<double>::infinity();
+  double max = -std::numeric_limits<double>::infinity();
+  DDSketch sketch;
+
+  void add(double value)
+  {
+    ++count;
+    sum += value;
+    min = (std::min)(min, value);
+    max = (std::max)(max, value);
+    sketch.add(value);
+  }
+
+  void merge(const WindowStats &other)
+  {
+    count += other.count;
+    sum += other.sum;
+    min = (std::min)(min, other.min);
+    max = (std::max)(max, other.max);
+    sketch.merge(other.sketch);
+  }
+
+  double quantile(double q) const
+  {
+    if (count == 0)
+      return std::numeric_limits<double>::quiet_NaN();
+    if (q <= 0.0)
+      return min;
+    if (q >= 1.0)
+      return max;
+    return (std::max)(min, (std::min)(max, sketch.quantile(q)));
+  }
+};
+
+/*
+ * A summary family (one name, many label sets) over fixed windows. Samples are
+ * observed by the sampling thread, Collect() runs in the HTTP threads and
+ * exports the last complete window of every series.
+ */
+class WindowSummary : public prometheus::Collectable
+{
+public:
+  typedef std::chrono::steady_clock clock;
+
+  WindowSummary(const std::string &name_, const std::string &help_, double window_)
+      : name(name_), help(help_), window(std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(window_))),
+        windowStart(clock::now())
+  {
+  }
+
+  // Returns the handle of the series with <labels>.
+  size_t add(const prometheus::Labels &labels)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    series.push_back(Series{labels, WindowStats(), WindowStats(), false});
+    return series.size() - 1;
+  }
+
+  void observe(size_t handle, double value)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    rotate(clock::now());
+    series[handle].current.add(value);
+  }
+
+  std::vector<prometheus::MetricFamily> Collect() const override
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    rotate(clock::now());
+    prometheus::MetricFamily family;
+    family.name = name;
+    family.help = help;
+    family.type = prometheus::MetricType::Summary;
+    for (const auto &s : series)
+    {
+      if (!s.complete)
+        continue;
+      prometheus::ClientMetric metric;
+      for (const auto &label : s.labels)
+        metric.label.push_back(prometheus::ClientMetric::Label{label.first, label.second});
+      metric.summary.sample_count = s.last.count;
+      metric.summary.sample_sum = s.last.sum;
+      for (const double q : {0.0, 0.5, 0.9, 0.99, 1.0})
+        metric.summary.quantile.push_back(prometheus::ClientMetric::Quantile{q, s.last.quantile(q)});
+      family.metric.push_back(metric);
+    }
+    return {family};
+  }
+
+private:
+  struct Series
+  {
+    prometheus::Labels labels;
+    WindowStats current;
+    WindowStats last;
+    bool complete;
+  };
+
+  const std::string name;
+  const std::string help;
+  const clock::duration window;
+  mutable std::mutex mutex;
+  mutable clock::time_point windowStart;
+  mutable std::vector<Series> series;
+
+  // Closes the windows that ended before <now>; a window without samples is exported as empty.
+  void rotate(clock::time_point now) const
+  {
+    if (now - windowStart < window)
+      return;
+    for (auto &s : series)
+    {
+      s.last = std::move(s.current);
+      s.current = WindowStats();
+      s.complete = true;
+    }
+    windowStart += window * ((now - windowStart) / window);
+  }
+};